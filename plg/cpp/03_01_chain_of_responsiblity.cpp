@@ -1,5 +1,26 @@
 #include <iostream>
 #include <string>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <type_traits>
+#include <filesystem>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -13,17 +34,25 @@ enum LEVEL {
 
 struct Logger {
     Logger* _next_logger;
+    ostream* _out = &cout;
     // Logger() { _next_logger=nullptr; };
     Logger(Logger* nl=nullptr) : _next_logger(nl) {};
+    virtual ~Logger() {};
 
     bool virtual can_handle(LEVEL lvl)=0;
-    void virtual write(string message)=0;
+    void virtual write(const string& message)=0;
+    // What handle() calls; override when the output records the level
+    void virtual write(const string& message, LEVEL) { write(message); }
 
     void set_next(Logger* nl) { _next_logger=nl; };
-    void handle(string message, LEVEL lvl) {
-        if (can_handle(lvl)) write(message);
+    // Redirects this logger and the rest of the chain
+    void set_output(ostream& out) {
+        for (Logger* l = this; l; l = l->_next_logger) l->_out = &out;
+    }
+    void handle(const string& message, LEVEL lvl) {
+        if (can_handle(lvl)) write(message, lvl);
         else if (_next_logger) _next_logger->handle(message, lvl);
-        else cout << "No one can handle this message: " << message << endl;
+        else *_out << "No one can handle this message: " << message << endl;
     }
 };
 
@@ -33,8 +62,8 @@ struct DebugLogger : public Logger {
         if (lvl==DEBUG) return true;
         return false;
     }
-    void write(string message) override {
-        cout << "[DEBUG]: " << message << endl;
+    void write(const string& message) override {
+        *_out << "[DEBUG]: " << message << endl;
     }
 };
 struct InfoLogger : public Logger {
@@ -43,8 +72,8 @@ struct InfoLogger : public Logger {
         if (lvl==INFO) return true;
         return false;
     }
-    void write(string message) override {
-        cout << "[INFO]: " << message << endl;
+    void write(const string& message) override {
+        *_out << "[INFO]: " << message << endl;
     }
 };
 struct WarningLogger : public Logger {
@@ -53,8 +82,8 @@ struct WarningLogger : public Logger {
         if (lvl==WARNING) return true;
         return false;
     }
-    void write(string message) override {
-        cout << "[WARNING]: " << message << endl;
+    void write(const string& message) override {
+        *_out << "[WARNING]: " << message << endl;
     }
 };
 struct ErrorLogger : public Logger {
@@ -63,14 +92,551 @@ struct ErrorLogger : public Logger {
         if (lvl==ERROR) return true;
         return false;
     }
-    void write(string message) override {
-        cout << "[ERROR]: " << message << endl;
+    void write(const string& message) override {
+        *_out << "[ERROR]: " << message << endl;
+    }
+};
+
+// A configured chain frozen into one handler list per LEVEL: handle() is an
+// indexed lookup instead of a can_handle() call per hop. freeze() keeps the
+// chain's rule that the first logger accepting a level takes it; add() puts
+// more handlers on a level. Levels below the minimum are dropped up front,
+// and log() does not even build their message.
+class LogDispatcher {
+    static const int LEVELS = UNHANDLED + 1;
+    vector<Logger*> _handlers[LEVELS];
+    ostream* _fallback = &cout;
+    LEVEL _min_level = DEBUG;
+
+public:
+    static LogDispatcher freeze(Logger* chain) {
+        LogDispatcher dispatcher;
+        if (chain) dispatcher._fallback = chain->_out;
+        for (int lvl = 0; lvl < LEVELS; lvl++) {
+            for (Logger* l = chain; l; l = l->_next_logger) {
+                if (l->can_handle(LEVEL(lvl))) {
+                    dispatcher._handlers[lvl].push_back(l);
+                    break;
+                }
+            }
+        }
+        return dispatcher;
+    }
+
+    void add(LEVEL lvl, Logger* logger) { _handlers[lvl].push_back(logger); }
+    void set_min_level(LEVEL lvl) { _min_level = lvl; }
+    bool enabled(LEVEL lvl) const { return lvl >= _min_level; }
+
+    void handle(const string& message, LEVEL lvl) {
+        if (!enabled(lvl)) return;
+        const vector<Logger*>& handlers = _handlers[lvl];
+        if (handlers.empty()) *_fallback << "No one can handle this message: " << message << endl;
+        for (Logger* l : handlers) l->write(message, lvl);
+    }
+
+    // make_message() is only called when lvl is enabled
+    template <typename MakeMessage>
+    void log(LEVEL lvl, MakeMessage make_message) {
+        if (enabled(lvl)) handle(make_message(), lvl);
+    }
+};
+
+// Format strings for BinaryLogger records, "{}" marks an argument. The
+// decoder uses the same table, so ids must only ever be appended.
+constexpr const char* BINARY_FORMATS[] = {
+    "{}",  // FORMAT_TEXT: the record carries raw text instead of arguments
+    "Request {} served in {} us",
+    "Cache {} evicted {} entries",
+};
+enum FORMAT_ID : uint16_t { FORMAT_TEXT, FORMAT_REQUEST, FORMAT_EVICTION };
+const size_t FORMAT_COUNT = sizeof(BINARY_FORMATS) / sizeof(BINARY_FORMATS[0]);
+
+constexpr size_t count_placeholders(const char* format) {
+    size_t count = 0;
+    for (; *format; format++) {
+        if (format[0] == '{' && format[1] == '}') {
+            count++;
+            format++;
+        }
+    }
+    return count;
+}
+
+// Number of arguments each format expects, indexed by FORMAT_ID
+struct FormatArgCounts {
+    size_t counts[FORMAT_COUNT] = {};
+    constexpr FormatArgCounts() {
+        for (size_t id = 0; id < FORMAT_COUNT; id++) counts[id] = count_placeholders(BINARY_FORMATS[id]);
+    }
+};
+constexpr FormatArgCounts BINARY_FORMAT_ARGS;
+
+// 64-byte record; a zero timestamp marks the unused tail of a file
+struct BinaryRecord {
+    static const size_t MAX_ARGS = 6;
+    uint64_t timestamp_ns;
+    uint8_t lvl;
+    uint8_t argc;
+    uint16_t format_id;
+    uint32_t text_length;
+    union {
+        int64_t args[MAX_ARGS];
+        char text[MAX_ARGS * sizeof(int64_t)];
+    };
+};
+static_assert(sizeof(BinaryRecord) == 64, "BinaryRecord layout changed");
+
+// Writes BinaryRecords straight into memory-mapped files path.0 .. path.N-1,
+// moving to the next one (and overwriting the oldest) when a file is full.
+// Nothing is formatted here: decode_binary_log() does that offline. Like the
+// other loggers it is not thread-safe. Windows builds have no mmap: there
+// the records of the current file are kept in memory and written out when
+// it is full or the logger is destroyed, so a crash loses that file.
+struct BinaryLogger : public Logger {
+    string _path;
+    LEVEL _min_level;
+    size_t _records_per_file;
+    size_t _file_count;
+    size_t _file_index = 0;
+    size_t _next_record = 0;
+#ifndef _WIN32
+    int _fd = -1;
+#else
+    vector<BinaryRecord> _buffer;
+#endif
+    BinaryRecord* _records = nullptr;
+
+    BinaryLogger(const string& path, LEVEL min_level=DEBUG, size_t file_bytes=1 << 20,
+                 size_t file_count=4, Logger* nl=nullptr) :
+        Logger(nl), _path(path), _min_level(min_level),
+        _records_per_file(max<size_t>(file_bytes / sizeof(BinaryRecord), 1)),
+        _file_count(max<size_t>(file_count, 1)) {
+        open_file(0);
+    }
+    ~BinaryLogger() override { close_file(); }
+
+    bool can_handle(LEVEL lvl) override {
+        return lvl >= _min_level && lvl != UNHANDLED;
+    }
+    // Called without a level, the record gets the lowest level accepted
+    void write(const string& message) override { write(message, _min_level); }
+    void write(const string& message, LEVEL lvl) override {
+        BinaryRecord& record = next_record(lvl, FORMAT_TEXT);
+        record.text_length = uint32_t(min(message.size(), sizeof(record.text)));
+        memcpy(record.text, message.data(), record.text_length);
+    }
+    // Hot-path entry point: only the format id and the raw arguments are
+    // stored, so they must be integers or enums, one per "{}" of the format
+    template <typename... Args>
+    void log(LEVEL lvl, FORMAT_ID format_id, Args... args) {
+        static_assert(sizeof...(Args) <= BinaryRecord::MAX_ARGS, "too many arguments");
+        static_assert((true && ... && (is_integral<Args>::value || is_enum<Args>::value)),
+                      "BinaryLogger arguments must be integers or enums");
+        if (format_id == FORMAT_TEXT || format_id >= FORMAT_COUNT)
+            throw invalid_argument("no argument format " + to_string(format_id));
+        if (BINARY_FORMAT_ARGS.counts[format_id] != sizeof...(Args))
+            throw invalid_argument("format " + to_string(format_id) + " takes "
+                                   + to_string(BINARY_FORMAT_ARGS.counts[format_id]) + " arguments");
+        if (!can_handle(lvl)) return;
+        BinaryRecord& record = next_record(lvl, format_id);
+        int64_t values[] = {static_cast<int64_t>(args)..., 0};
+        record.argc = uint8_t(sizeof...(Args));
+        memcpy(record.args, values, sizeof...(Args) * sizeof(int64_t));
+    }
+
+private:
+    static string file_name(const string& path, size_t index) { return path + "." + to_string(index); }
+
+    void open_file(size_t index) {
+        _file_index = index;
+        _next_record = 0;
+        string name = file_name(_path, index);
+#ifndef _WIN32
+        size_t bytes = _records_per_file * sizeof(BinaryRecord);
+        _fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (_fd < 0 || ::ftruncate(_fd, bytes) != 0) throw runtime_error("cannot create " + name);
+        void* map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (map == MAP_FAILED) throw runtime_error("cannot map " + name);
+        _records = static_cast<BinaryRecord*>(map);
+#else
+        if (!ofstream(name, ios::binary | ios::trunc)) throw runtime_error("cannot create " + name);
+        _buffer.assign(_records_per_file, BinaryRecord());
+        _records = _buffer.data();
+#endif
+    }
+
+    void close_file() {
+#ifndef _WIN32
+        if (_records) munmap(_records, _records_per_file * sizeof(BinaryRecord));
+        if (_fd >= 0) ::close(_fd);
+        _fd = -1;
+#else
+        if (_records) {
+            ofstream out(file_name(_path, _file_index), ios::binary | ios::trunc);
+            out.write(reinterpret_cast<const char*>(_records), _records_per_file * sizeof(BinaryRecord));
+        }
+#endif
+        _records = nullptr;
+    }
+
+    BinaryRecord& next_record(LEVEL lvl, FORMAT_ID format_id) {
+        if (_next_record == _records_per_file) {
+            close_file();
+            open_file((_file_index + 1) % _file_count);
+        }
+        BinaryRecord& record = _records[_next_record++];
+        record.timestamp_ns = uint64_t(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count());
+        record.lvl = uint8_t(lvl);
+        record.argc = 0;
+        record.format_id = format_id;
+        record.text_length = 0;
+        return record;
+    }
+};
+
+// Offline decoder: reads every rotated file of a BinaryLogger, orders the
+// records by time and prints them as text. Returns the number of records.
+size_t decode_binary_log(const string& path, size_t file_count, ostream& out) {
+    static const char* const LEVEL_NAMES[] = {"DEBUG", "INFO", "WARNING", "ERROR", "UNHANDLED"};
+    vector<BinaryRecord> records;
+    for (size_t index = 0; index < file_count; index++) {
+        ifstream in(path + "." + to_string(index), ios::binary);
+        BinaryRecord record;
+        while (in.read(reinterpret_cast<char*>(&record), sizeof(record)) && record.timestamp_ns != 0) {
+            records.push_back(record);
+        }
+    }
+    stable_sort(records.begin(), records.end(), [](const BinaryRecord& a, const BinaryRecord& b) {
+        return a.timestamp_ns < b.timestamp_ns;
+    });
+
+    for (const BinaryRecord& record : records) {
+        out << record.timestamp_ns << " [" << (record.lvl <= UNHANDLED ? LEVEL_NAMES[record.lvl] : "?") << "]: ";
+        if (record.format_id == FORMAT_TEXT) {
+            out.write(record.text, min<size_t>(record.text_length, sizeof(record.text)));
+        } else if (record.format_id < FORMAT_COUNT) {
+            size_t arg = 0;
+            for (const char* f = BINARY_FORMATS[record.format_id]; *f; f++) {
+                if (f[0] == '{' && f[1] == '}' && arg < record.argc) {
+                    out << record.args[arg++];
+                    f++;
+                } else {
+                    out << *f;
+                }
+            }
+        } else {
+            out << "<unknown format " << record.format_id << ">";
+        }
+        out << '\n';
+    }
+    return records.size();
+}
+
+// Fixed-size slot in a LogRing; a longer message goes on in the next slots
+struct LogRecord {
+    static constexpr size_t TEXT_SIZE = 116;
+    LEVEL lvl;
+    uint32_t length;
+    bool continued;  // the next slot holds more of the same message
+    char text[TEXT_SIZE];
+};
+static_assert(sizeof(LogRecord) == 128, "LogRecord layout changed");
+
+// Single-producer single-consumer ring: the owning thread pushes, the
+// AsyncLogger writer thread pops. No locks, one release store per side.
+// The producer closes the ring when its thread exits.
+class LogRing {
+    static const size_t SIZE = 1 << 14;
+    vector<LogRecord> _slots;
+    string _partial;  // writer side: start of a message still being popped
+    atomic<bool> _closed{false};
+    alignas(64) atomic<size_t> _head{0};  // next slot to pop
+    alignas(64) atomic<size_t> _tail{0};  // next slot to push
+
+public:
+    LogRing() : _slots(SIZE) {}
+
+    // Waits for free slots while the ring is full
+    void push(const string& message, LEVEL lvl) {
+        size_t offset = 0;
+        do {
+            size_t tail = _tail.load(memory_order_relaxed);
+            while (tail - _head.load(memory_order_acquire) == SIZE) this_thread::yield();
+            LogRecord& record = _slots[tail & (SIZE - 1)];
+            record.lvl = lvl;
+            record.length = uint32_t(min(message.size() - offset, LogRecord::TEXT_SIZE));
+            memcpy(record.text, message.data() + offset, record.length);
+            offset += record.length;
+            record.continued = offset < message.size();
+            _tail.store(tail + 1, memory_order_release);
+        } while (offset < message.size());
+    }
+
+    // True once a whole message has been popped into message
+    bool pop(string& message, LEVEL& lvl) {
+        for (;;) {
+            size_t head = _head.load(memory_order_relaxed);
+            if (head == _tail.load(memory_order_acquire)) return false;
+            const LogRecord& record = _slots[head & (SIZE - 1)];
+            _partial.append(record.text, record.length);
+            bool continued = record.continued;
+            lvl = record.lvl;
+            _head.store(head + 1, memory_order_release);
+            if (!continued) {
+                message.swap(_partial);
+                _partial.clear();
+                return true;
+            }
+        }
+    }
+
+    void close() { _closed.store(true, memory_order_release); }
+
+    // Closed and drained: nothing will ever be pushed or popped again
+    bool finished() const {
+        return _closed.load(memory_order_acquire)
+            && _head.load(memory_order_relaxed) == _tail.load(memory_order_acquire);
+    }
+};
+
+// Async front end for a chain: handle() only copies the message into the
+// calling thread's ring. A writer thread runs the chain on everything queued,
+// into a memory buffer, and writes each batch to out at once. The chain must
+// not be used directly while it belongs to an AsyncLogger; its outputs are
+// restored when the AsyncLogger is destroyed.
+class AsyncLogger {
+    Logger* _chain;
+    ostream& _out;
+    const uint64_t _id;
+    mutex _rings_lock;
+    vector<shared_ptr<LogRing>> _rings;
+    atomic<bool> _stopping{false};
+    thread _writer;
+
+    // A thread's rings, by AsyncLogger id. Only the AsyncLogger owns them, so
+    // a destroyed logger's rings are freed with it; rings still alive when
+    // the thread exits are closed, and the writer frees them once drained.
+    struct ThreadRings {
+        unordered_map<uint64_t, weak_ptr<LogRing>> rings;
+        ~ThreadRings() {
+            for (auto& entry : rings) {
+                if (shared_ptr<LogRing> ring = entry.second.lock()) ring->close();
+            }
+        }
+    };
+
+    static uint64_t next_id() {
+        static atomic<uint64_t> ids{0};
+        return ++ids;
+    }
+
+    LogRing* local_ring() {
+        thread_local uint64_t last_id = 0;
+        thread_local LogRing* last_ring = nullptr;
+        thread_local ThreadRings local;
+        if (last_id == _id) return last_ring;
+        shared_ptr<LogRing> ring = local.rings[_id].lock();
+        if (!ring) {
+            for (auto entry = local.rings.begin(); entry != local.rings.end();) {
+                entry = entry->second.expired() ? local.rings.erase(entry) : next(entry);
+            }
+            ring.reset(new LogRing());  // no make_shared: weak_ptrs would keep the slots allocated
+            {
+                lock_guard<mutex> guard(_rings_lock);
+                _rings.push_back(ring);
+            }
+            local.rings[_id] = ring;
+        }
+        last_id = _id;
+        last_ring = ring.get();
+        return last_ring;
+    }
+
+    void writer_loop() {
+        ostringstream batch;
+        vector<ostream*> outputs;  // the chain's own, put back on exit
+        for (Logger* l = _chain; l; l = l->_next_logger) outputs.push_back(l->_out);
+        _chain->set_output(batch);
+        vector<shared_ptr<LogRing>> rings;
+        string message;
+        LEVEL lvl;
+        for (;;) {
+            bool stopping = _stopping.load(memory_order_acquire);
+            {
+                lock_guard<mutex> guard(_rings_lock);
+                _rings.erase(remove_if(_rings.begin(), _rings.end(),
+                                       [](const shared_ptr<LogRing>& ring) { return ring->finished(); }),
+                             _rings.end());
+                rings = _rings;
+            }
+            size_t drained = 0;
+            for (const shared_ptr<LogRing>& ring : rings) {
+                while (ring->pop(message, lvl)) {
+                    _chain->handle(message, lvl);
+                    drained++;
+                }
+            }
+            if (drained) {
+                string text = batch.str();
+                _out.write(text.data(), text.size());
+                _out.flush();
+                batch.str("");
+            } else if (stopping) {
+                break;
+            } else {
+                this_thread::sleep_for(chrono::microseconds(200));
+            }
+        }
+        size_t index = 0;
+        for (Logger* l = _chain; l; l = l->_next_logger) l->_out = outputs[index++];
+    }
+
+public:
+    AsyncLogger(Logger* chain, ostream& out=cout) : _chain(chain), _out(out), _id(next_id()) {
+        _writer = thread(&AsyncLogger::writer_loop, this);
+    }
+    // Everything handled before this point is written out
+    ~AsyncLogger() {
+        _stopping.store(true, memory_order_release);
+        _writer.join();
+    }
+
+    void handle(const string& message, LEVEL lvl) {
+        local_ring()->push(message, lvl);
+    }
+
+    // Rings not yet freed, one per producer thread
+    size_t ring_count() {
+        lock_guard<mutex> guard(_rings_lock);
+        return _rings.size();
     }
 };
 
 int NM = 5;
 
-int main() {
+// Benchmark and demo files go to the temp directory, not the working one
+string scratch_path(const string& name) {
+    return (filesystem::temp_directory_path() / name).string();
+}
+
+// Per-call latency seen by producer threads, percentiles in ns
+template <typename Handle>
+void measure_producers(const char* name, int threads, int messages, Handle handle) {
+    vector<vector<double>> latencies(threads);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            string message = "Request " + to_string(t) + " served";
+            latencies[t].reserve(messages);
+            for (int i = 0; i < messages; i++) {
+                auto start = chrono::steady_clock::now();
+                handle(message, LEVEL(i % 4));
+                latencies[t].push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    vector<double> all;
+    for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    sort(all.begin(), all.end());
+    cout << "  " << name << ": p50 " << all[all.size() / 2] << " ns, p99 " << all[all.size() * 99 / 100] << " ns" << endl;
+}
+
+void benchmark_async(Logger* chain, int threads, int messages) {
+    string sync_path = scratch_path("logger_sync.txt"), async_path = scratch_path("logger_async.txt");
+    ofstream sync_file(sync_path), async_file(async_path);
+    cout << threads << " threads x " << messages << " messages:" << endl;
+
+    mutex chain_lock;
+    ostream* chain_out = chain->_out;
+    chain->set_output(sync_file);
+    measure_producers("sync chain ", threads, messages, [&](const string& message, LEVEL lvl) {
+        lock_guard<mutex> guard(chain_lock);
+        chain->handle(message, lvl);
+    });
+    {
+        AsyncLogger async(chain, async_file);
+        measure_producers("async rings", threads, messages, [&](const string& message, LEVEL lvl) {
+            async.handle(message, lvl);
+        });
+        // The producer threads have exited, their rings go once drained
+        for (int i = 0; i < 1000 && async.ring_count(); i++) this_thread::sleep_for(chrono::milliseconds(1));
+        cout << "  rings left after the producers exited: " << async.ring_count() << endl;
+    }
+    chain->set_output(*chain_out);
+    remove(sync_path.c_str());
+    remove(async_path.c_str());
+}
+
+// Chain walk against the frozen table, output discarded so only dispatch is timed
+void benchmark_dispatch(Logger* chain, int messages) {
+    ostream discard(nullptr);
+    chain->set_output(discard);
+    LogDispatcher dispatcher = LogDispatcher::freeze(chain);
+    string message = "Disk almost full";
+    cout << messages << " messages:" << endl;
+
+    for (LEVEL lvl : {DEBUG, ERROR}) {
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < messages; i++) chain->handle(message, lvl);
+        double chain_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / messages;
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < messages; i++) dispatcher.handle(message, lvl);
+        double table_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / messages;
+        cout << "  level " << lvl << ": chain " << chain_ns << " ns, table " << table_ns << " ns" << endl;
+    }
+
+    dispatcher.set_min_level(INFO);
+    int built = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < messages; i++) {
+        dispatcher.log(DEBUG, [&] { built++; return "Request " + to_string(i) + " took " + to_string(i % 97) + " ms"; });
+    }
+    double disabled_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / messages;
+    cout << "  disabled DEBUG: " << disabled_ns << " ns, " << built << " messages built" << endl;
+    chain->set_output(cout);
+}
+
+// Formatting each line on the hot path against storing raw arguments
+void benchmark_binary(int messages) {
+    string text_path = scratch_path("logger_text.txt"), decoded_path = scratch_path("logger_decoded.txt");
+    string binary_path = scratch_path("logger_binary");
+    ofstream text_file(text_path);
+    InfoLogger text_logger;
+    text_logger.set_output(text_file);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < messages; i++) {
+        text_logger.handle("Request " + to_string(i) + " served in " + to_string(i % 977) + " us", INFO);
+    }
+    double text_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / messages;
+
+    size_t records;
+    double binary_ns;
+    {
+        BinaryLogger binary(binary_path, DEBUG, 4 << 20, 4);
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < messages; i++) binary.log(INFO, FORMAT_REQUEST, i, i % 977);
+        binary_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / messages;
+    }
+    ofstream decoded(decoded_path);
+    start = chrono::steady_clock::now();
+    records = decode_binary_log(binary_path, 4, decoded);
+    double decode_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    cout << messages << " messages: text " << text_ns << " ns, binary " << binary_ns << " ns each" << endl;
+    cout << "  decoded " << records << " records kept by rotation in " << decode_ms << " ms" << endl;
+    remove(text_path.c_str());
+    remove(decoded_path.c_str());
+    for (int i = 0; i < 4; i++) remove((binary_path + "." + to_string(i)).c_str());
+}
+
+int main(int argc, char** argv) {
+    // Decoder tool: <program> decode <path> [file count]
+    if (argc >= 3 && string(argv[1]) == "decode") {
+        decode_binary_log(argv[2], argc >= 4 ? stoul(argv[3]) : 4, cout);
+        return 0;
+    }
 
     ErrorLogger* error_logger = new ErrorLogger();
     WarningLogger* warning_logger = new WarningLogger(error_logger);
@@ -92,4 +658,36 @@ int main() {
         // cout << i << endl;
         debug_logger->handle(msg[i], lvls[i]);
         }
+
+    {
+        AsyncLogger async(debug_logger);
+        for (int i=0; i<NM; i++) async.handle(msg[i], lvls[i]);
+        async.handle("A message longer than one ring slot" + string(LogRecord::TEXT_SIZE, '.') + " arrives whole", INFO);
+    }
+
+    LogDispatcher dispatcher = LogDispatcher::freeze(debug_logger);
+    dispatcher.add(ERROR, warning_logger);
+    dispatcher.set_min_level(INFO);
+    for (int i=0; i<NM; i++) dispatcher.handle(msg[i], lvls[i]);
+
+    string demo_path = scratch_path("binary_demo");
+    {
+        BinaryLogger binary(demo_path, WARNING);
+        binary.log(ERROR, FORMAT_EVICTION, 3, 128);
+        binary.log(INFO, FORMAT_REQUEST, 42, 850);  // below WARNING, dropped
+        binary.handle("Warning Message!", WARNING);
+        LogDispatcher::freeze(&binary).handle("Error Message!", ERROR);
+    }
+    decode_binary_log(demo_path, 4, cout);
+    for (int i = 0; i < 4; i++) remove((demo_path + "." + to_string(i)).c_str());
+
+    // The benchmarks take minutes in a debug build, so they only run on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmarks" << endl;
+        return 0;
+    }
+
+    benchmark_async(debug_logger, 4, 200000);
+    benchmark_dispatch(debug_logger, 10000000);
+    benchmark_binary(2000000);
 }
\ No newline at end of file
@@ -1,36 +1,294 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <deque>
+#include <memory>
+#include <cctype>
+#include <typeinfo>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <exception>
+#include <filesystem>
+#include <fcntl.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#endif
+#include <unistd.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 using namespace std;
 
+// MinGW has no fsync(), and its rename() does not replace an existing file
+int sync_file(int fd) {
+#ifdef _WIN32
+    return _commit(fd);
+#else
+    return ::fsync(fd);
+#endif
+}
+
+bool replace_file(const string &from, const string &to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return ::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// Makes a rename inside the directory holding path durable. MOVEFILE_WRITE_THROUGH
+// already waits for that on Windows; POSIX needs an fsync of the directory.
+int sync_parent_directory(const string &path) {
+#ifdef _WIN32
+    (void)path;
+    return 0;
+#else
+    size_t slash = path.find_last_of('/');
+    string directory = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+    int result = ::fsync(fd);
+    ::close(fd);
+    return result;
+#endif
+}
+
+// Journal records: a kind byte, then varints for position and length, then
+// the inserted bytes. A typed character costs 4 bytes.
+enum RecordKind : uint8_t { RECORD_INSERT = 1, RECORD_DELETE = 2 };
+
+void put_varint(string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+bool get_varint(const string &in, size_t &offset, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; offset < in.size() && shift < 64; shift += 7) {
+        uint8_t byte = in[offset++];
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void encode_insert(string &out, int position, const string &text) {
+    out += char(RECORD_INSERT);
+    put_varint(out, position);
+    put_varint(out, text.size());
+    out += text;
+}
+
+void encode_delete(string &out, int position, int length) {
+    out += char(RECORD_DELETE);
+    put_varint(out, position);
+    put_varint(out, length);
+}
+
 struct Command {
+    virtual ~Command() {};
     void virtual execute()=0;
     void virtual undo()=0;
+    // Absorb a command executed right after this one, so both undo together
+    bool virtual merge(const Command &) { return false; }
+    // Bytes held by this command, including its heap buffers
+    size_t virtual footprint() const=0;
+    // Journal record for the edit done by execute(), or by undo()
+    void virtual encode(string &out, bool undone) const=0;
 };
 
+// Piece table: the text is a sequence of pieces, each one a slice of the
+// append-only buffer `added`. Pieces are kept in an implicit treap ordered by
+// position (every node knows the length of its subtree), so locating, cutting
+// and joining at an offset are O(log n) and edits never copy existing text.
 struct Document {
-    string content;
-    Document() : content("") {};
+    struct Piece {
+        size_t start;
+        size_t length;
+        size_t subtree;  // total length of this piece and its descendants
+        uint32_t priority;
+        int left;
+        int right;
+    };
+
+    string added;
+    vector<Piece> nodes;
+    vector<int> free_nodes;
+    int root = -1;
+    uint32_t seed = 2463534242u;
+
+    Document() {};
+
+    size_t size() const { return subtree(root); }
+    size_t piece_count() const { return nodes.size() - free_nodes.size(); }
+
     void insert_text(string text, int position=0) {
-        // cout << "DBG: " << content.size() << endl; // DEBUG
-        content = content.substr(0, position) + 
-                  text + 
-                  content.substr(position);
-        
-        // cout << "DBG: " << content.size() << endl; // DEBUG
-        // cout << "DBG: " << &content << " " << content << endl; // DEBUG
+        if (position < 0 || size_t(position) > size()) throw out_of_range("insert position out of range");
+        if (text.empty()) return;
+        int left, right;
+        split(root, position, left, right);
+        // Typing appends to `added` right behind the previous keystroke, so
+        // the piece before the cursor usually just grows
+        if (!extend_last(left, text.size())) left = merge(left, new_node(added.size(), text.size()));
+        added += text;
+        root = merge(left, right);
     }
     string delete_text(int position, int length) {
-        string deleted_text = content.substr(position, length);
-        cout << "Del txt " << deleted_text << endl;
-        content = content.substr(0, position) + content.substr(position+length);
+        if (position < 0 || size_t(position) > size()) throw out_of_range("delete position out of range");
+        int left, middle, right;
+        split(root, position, left, middle);
+        split(middle, max(length, 0), middle, right);
+        string deleted_text;
+        deleted_text.reserve(subtree(middle));
+        append_text(middle, deleted_text);
+        release(middle);
+        root = merge(left, right);
         return deleted_text;
     }
+    // Rewrites `added` to hold only the live text, as a single piece. Deleted
+    // and overwritten text otherwise stays in `added` for good.
+    void compact() {
+        string live = text();
+        added.swap(live);
+        nodes.clear();
+        free_nodes.clear();
+        root = added.empty() ? -1 : new_node(0, added.size());
+    }
+    string text() const {
+        string result;
+        result.reserve(size());
+        append_text(root, result);
+        return result;
+    }
     friend ostream &operator << (ostream &o, const Document &doc) {
-        o << doc.content;
+        doc.write(doc.root, o);
         return o;
     }
+
+private:
+    size_t subtree(int node) const { return node < 0 ? 0 : nodes[node].subtree; }
+
+    void update(int node) {
+        nodes[node].subtree = subtree(nodes[node].left) + nodes[node].length + subtree(nodes[node].right);
+    }
+
+    // Grows the last piece of the tree at node by length bytes, if that piece
+    // ends where the next text will be appended to `added`
+    bool extend_last(int node, size_t length) {
+        if (node < 0) return false;
+        Piece &piece = nodes[node];
+        if (piece.right >= 0 ? !extend_last(piece.right, length) : piece.start + piece.length != added.size())
+            return false;
+        if (piece.right < 0) piece.length += length;
+        update(node);
+        return true;
+    }
+
+    int new_node(size_t start, size_t length) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        Piece piece = {start, length, length, seed, -1, -1};
+        if (free_nodes.empty()) {
+            nodes.push_back(piece);
+            return int(nodes.size()) - 1;
+        }
+        int node = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[node] = piece;
+        return node;
+    }
+
+    void release(int node) {
+        if (node < 0) return;
+        release(nodes[node].left);
+        release(nodes[node].right);
+        free_nodes.push_back(node);
+    }
+
+    // left gets the first `position` characters, right the rest. A piece
+    // straddling the cut is split in two.
+    void split(int node, size_t position, int &left, int &right) {
+        if (node < 0) {
+            left = right = -1;
+            return;
+        }
+        size_t left_length = subtree(nodes[node].left);
+        size_t length = nodes[node].length;
+        if (position <= left_length) {
+            int child_left, child_right;
+            split(nodes[node].left, position, child_left, child_right);
+            nodes[node].left = child_right;
+            update(node);
+            left = child_left;
+            right = node;
+        } else if (position >= left_length + length) {
+            int child_left, child_right;
+            split(nodes[node].right, position - left_length - length, child_left, child_right);
+            nodes[node].right = child_left;
+            update(node);
+            left = node;
+            right = child_right;
+        } else {
+            size_t offset = position - left_length;
+            int tail = new_node(nodes[node].start + offset, length - offset);
+            int rest = nodes[node].right;
+            nodes[node].length = offset;
+            nodes[node].right = -1;
+            update(node);
+            left = node;
+            right = merge(tail, rest);
+        }
+    }
+
+    int merge(int left, int right) {
+        if (left < 0) return right;
+        if (right < 0) return left;
+        if (nodes[left].priority > nodes[right].priority) {
+            int merged = merge(nodes[left].right, right);
+            nodes[left].right = merged;
+            update(left);
+            return left;
+        }
+        int merged = merge(left, nodes[right].left);
+        nodes[right].left = merged;
+        update(right);
+        return right;
+    }
+
+    void append_text(int node, string &out) const {
+        if (node < 0) return;
+        append_text(nodes[node].left, out);
+        out.append(added, nodes[node].start, nodes[node].length);
+        append_text(nodes[node].right, out);
+    }
+
+    void write(int node, ostream &o) const {
+        if (node < 0) return;
+        write(nodes[node].left, o);
+        o.write(added.data() + nodes[node].start, nodes[node].length);
+        write(nodes[node].right, o);
+    }
 };
 
 struct InsertTextCommand : public Command {
@@ -46,9 +304,22 @@ struct InsertTextCommand : public Command {
         // cout << "DBG-ITex: " << &_doc << " " << _doc->content << endl; // DEBUG
     }
     void undo() override {
-        cout << "DBG: undo insert " << _position << endl;
         _doc->delete_text(_position, _text.size());
     }
+    // Typing runs: text inserted right after this one, up to the next word
+    bool merge(const Command &next) override {
+        auto insert = dynamic_cast<const InsertTextCommand*>(&next);
+        if (!insert || insert->_doc != _doc || insert->_text.empty()) return false;
+        if (insert->_position != _position + int(_text.size())) return false;
+        if (isspace(static_cast<unsigned char>(insert->_text[0]))) return false;
+        _text += insert->_text;
+        return true;
+    }
+    size_t footprint() const override { return sizeof(*this) + _text.capacity(); }
+    void encode(string &out, bool undone) const override {
+        if (undone) encode_delete(out, _position, _text.size());
+        else encode_insert(out, _position, _text);
+    }
 };
 
 struct DeleteTextCommand : public Command {
@@ -67,56 +338,446 @@ struct DeleteTextCommand : public Command {
     void undo() override {
         _doc->insert_text(_deleted_text, _position);
     }
+    size_t footprint() const override { return sizeof(*this) + _deleted_text.capacity(); }
+    void encode(string &out, bool undone) const override {
+        if (undone) encode_insert(out, _position, _deleted_text);
+        else encode_delete(out, _position, _deleted_text.size());
+    }
 };
 
+// Append-only command journal with periodic snapshots. The editing thread
+// only encodes into a pending buffer; a writer thread takes everything queued
+// so far, writes it and fsyncs once for the whole batch (group commit).
+//
+// The first I/O error stops the writer; append(), snapshot() and sync() then
+// rethrow it.
+//
+// Files: <path> holds a header with a generation number followed by records,
+// <path>.snap holds the document text for a generation. Once a snapshot is
+// renamed into place the journal is restarted under the new generation, so a
+// journal whose generation does not match the snapshot is already covered by
+// it and is skipped on replay.
+class CommandJournal {
+    string path;
+    int fd = -1;
+    uint32_t generation = 0;
+    mutex lock;
+    condition_variable wake;
+    condition_variable synced;
+    string pending;
+    string pending_snapshot;
+    bool has_snapshot = false;
+    bool stopping = false;
+    uint64_t appended = 0;
+    uint64_t written = 0;
+    uint64_t fsyncs = 0;
+    exception_ptr error;
+    thread writer;
+
+    static void write_all(int fd, const string &data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error("journal write failed: " + string(strerror(errno)));
+            }
+            done += n;
+        }
+    }
+
+    static void sync_or_throw(int fd, const string &name) {
+        if (sync_file(fd) != 0) throw runtime_error("cannot sync " + name + ": " + strerror(errno));
+    }
+
+    static string header(const char *magic, uint32_t generation) {
+        string out(magic, 4);
+        for (int i = 0; i < 4; i++) out += char(generation >> (8 * i));
+        return out;
+    }
+
+    static bool read_file(const string &path, string &data) {
+        ifstream in(path, ios::binary);
+        if (!in) return false;
+        data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        return true;
+    }
+
+    static uint32_t read_generation(const string &data, const char *magic) {
+        if (data.size() < 8 || data.compare(0, 4, magic) != 0) return UINT32_MAX;
+        uint32_t generation = 0;
+        for (int i = 0; i < 4; i++) generation |= uint32_t(uint8_t(data[4 + i])) << (8 * i);
+        return generation;
+    }
+
+    void write_snapshot(const string &text) {
+        string tmp = path + ".snap.tmp";
+        int snap = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+        if (snap < 0) throw runtime_error("cannot open " + tmp);
+        try {
+            write_all(snap, header("CSNP", generation + 1) + text);
+            sync_or_throw(snap, tmp);
+        } catch (...) {
+            ::close(snap);
+            throw;
+        }
+        ::close(snap);
+        if (!replace_file(tmp, path + ".snap")) throw runtime_error("cannot rename " + tmp);
+        // The old journal may only go once the new snapshot survives a crash
+        if (sync_parent_directory(path) != 0) throw runtime_error("cannot sync the directory of " + path);
+        generation++;
+        if (::ftruncate(fd, 0) != 0) throw runtime_error("cannot truncate " + path);
+        ::lseek(fd, 0, SEEK_SET);
+        write_all(fd, header("CJNL", generation));
+    }
+
+    void writer_loop() {
+        string batch;
+        string snapshot;
+        for (;;) {
+            bool snapshot_due;
+            uint64_t batch_end;
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || !pending.empty() || has_snapshot; });
+                if (pending.empty() && !has_snapshot) return;
+                batch.swap(pending);
+                pending.clear();
+                snapshot_due = has_snapshot;
+                if (snapshot_due) snapshot.swap(pending_snapshot);
+                has_snapshot = false;
+                batch_end = appended;
+            }
+            try {
+                if (snapshot_due) write_snapshot(snapshot);
+                write_all(fd, batch);
+                sync_or_throw(fd, path);
+            } catch (...) {
+                lock_guard<mutex> guard(lock);
+                error = current_exception();
+                synced.notify_all();
+                return;
+            }
+            lock_guard<mutex> guard(lock);
+            fsyncs++;
+            written = batch_end;
+            synced.notify_all();
+        }
+    }
+
+public:
+    // valid_bytes is Replayed::valid_bytes from replay(); anything after it
+    // is cut off, so new records do not land behind a torn one
+    CommandJournal(const string &path, size_t valid_bytes) : path(path) {
+        string snapshot, journal;
+        read_file(path + ".snap", snapshot);
+        read_file(path, journal);
+        generation = read_generation(snapshot, "CSNP");
+        if (generation == UINT32_MAX) generation = 0;
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_BINARY, 0644);
+        if (fd < 0) throw runtime_error("cannot open journal " + path);
+        if (read_generation(journal, "CJNL") != generation || valid_bytes < 8) {
+            if (::ftruncate(fd, 0) != 0) throw runtime_error("cannot truncate " + path);
+            write_all(fd, header("CJNL", generation));
+            sync_or_throw(fd, path);
+        } else if (valid_bytes < journal.size()) {
+            if (::ftruncate(fd, valid_bytes) != 0) throw runtime_error("cannot truncate " + path);
+            sync_or_throw(fd, path);
+        }
+        writer = thread(&CommandJournal::writer_loop, this);
+    }
+
+    ~CommandJournal() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        writer.join();
+        ::close(fd);
+    }
+
+    struct Replayed {
+        size_t records = 0;
+        size_t valid_bytes = 0;  // journal bytes up to the end of the last good record
+    };
+
+    // Rebuilds doc from the snapshot and the records after it. Replay stops
+    // at the first record that is torn, from a crash mid-write, or does not
+    // fit the document.
+    static Replayed replay(const string &path, Document &doc) {
+        string snapshot, journal;
+        uint32_t generation = 0;
+        if (read_file(path + ".snap", snapshot) && read_generation(snapshot, "CSNP") != UINT32_MAX) {
+            generation = read_generation(snapshot, "CSNP");
+            doc.insert_text(snapshot.substr(8), doc.size());
+        }
+        Replayed replayed;
+        if (!read_file(path, journal) || read_generation(journal, "CJNL") != generation) return replayed;
+
+        size_t offset = 8;
+        replayed.valid_bytes = offset;
+        while (offset < journal.size()) {
+            uint8_t kind = journal[offset++];
+            uint64_t position, length;
+            if (!get_varint(journal, offset, position) || !get_varint(journal, offset, length)) break;
+            if (position > doc.size()) break;
+            if (kind == RECORD_INSERT) {
+                if (length > journal.size() - offset) break;
+                InsertTextCommand(doc, journal.substr(offset, length), position).execute();
+                offset += length;
+            } else if (kind == RECORD_DELETE) {
+                if (length > doc.size() - position) break;
+                DeleteTextCommand(doc, position, length).execute();
+            } else {
+                break;
+            }
+            replayed.records++;
+            replayed.valid_bytes = offset;
+        }
+        return replayed;
+    }
+
+    void append(const Command &command, bool undone=false) {
+        {
+            lock_guard<mutex> guard(lock);
+            if (error) rethrow_exception(error);
+            command.encode(pending, undone);
+            appended++;
+        }
+        wake.notify_one();
+    }
+
+    // Records queued before the snapshot are covered by it and never written
+    void snapshot(string text) {
+        {
+            lock_guard<mutex> guard(lock);
+            if (error) rethrow_exception(error);
+            pending_snapshot = move(text);
+            has_snapshot = true;
+            pending.clear();
+            appended++;
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until everything appended so far is on disk
+    void sync() {
+        unique_lock<mutex> guard(lock);
+        uint64_t target = appended;
+        synced.wait(guard, [&] { return written >= target || error; });
+        if (error) rethrow_exception(error);
+    }
+
+    uint64_t fsync_count() {
+        lock_guard<mutex> guard(lock);
+        return fsyncs;
+    }
+};
+
+// Owns its commands. History is kept under memory_budget bytes: adjacent
+// commands are merged when they allow it, and the oldest ones are dropped
+// (and can no longer be undone) once the budget is exceeded.
 struct TextEditor {
     Document _doc;
-    vector<Command*> history={};
-    vector<Command*> undo_stack={};
-    void execute_command(Command& command) {
-        command.execute();
-        history.push_back(&command);
+    deque<unique_ptr<Command>> history={};
+    vector<unique_ptr<Command>> undo_stack={};
+    size_t memory_budget;
+    size_t memory_used = 0;
+    size_t dropped = 0;
+    unique_ptr<CommandJournal> journal;
+    size_t snapshot_every = 0;
+    size_t since_snapshot = 0;
+    TextEditor(size_t memory_budget=1 << 20) : memory_budget(memory_budget) {};
+    // Replays what the journal at path holds into the document, then logs
+    // every further edit there, with a snapshot every snapshot_every edits
+    size_t open_journal(const string &path, size_t snapshot_every=100000) {
+        journal.reset();
+        CommandJournal::Replayed replayed = CommandJournal::replay(path, _doc);
+        journal.reset(new CommandJournal(path, replayed.valid_bytes));
+        this->snapshot_every = snapshot_every;
+        since_snapshot = replayed.records;
+        return replayed.records;
+    }
+    void execute_command(unique_ptr<Command> command) {
+        command->execute();
+        log(*command, false);
+        for (auto &c : undo_stack) memory_used -= c->footprint();
         undo_stack.clear();
+        if (!history.empty()) {
+            size_t before = history.back()->footprint();
+            if (history.back()->merge(*command)) {
+                memory_used += history.back()->footprint() - before;
+                trim();
+                return;
+            }
+        }
+        memory_used += command->footprint();
+        history.push_back(move(command));
+        trim();
     }
     void undo() {
         if (history.size() == 0) return;
-        Command* command = history.back();
+        unique_ptr<Command> command = move(history.back());
         command->undo();
+        log(*command, true);
         history.pop_back();
-        undo_stack.push_back(command);
+        undo_stack.push_back(move(command));
     }
     void redo() {
         if (undo_stack.size() == 0) return;
-        Command* command = undo_stack.back();
+        unique_ptr<Command> command = move(undo_stack.back());
         command->execute();
+        log(*command, false);
         undo_stack.pop_back();
-        history.push_back(command);
+        history.push_back(move(command));
     }
+    size_t memory_footprint() const { return memory_used; }
     void show_document() {
         // cout << "DBG-SH: " << &_doc << " " << _doc.content << endl; // DEBUG
         cout << _doc << endl;
     }
+
+private:
+    void log(const Command &command, bool undone) {
+        if (!journal) return;
+        journal->append(command, undone);
+        if (snapshot_every && ++since_snapshot >= snapshot_every) {
+            _doc.compact();
+            journal->snapshot(_doc.text());
+            since_snapshot = 0;
+        }
+    }
+
+    // The newest command always stays, so the last edit can be undone
+    void trim() {
+        while (memory_used > memory_budget && history.size() > 1) {
+            memory_used -= history.front()->footprint();
+            history.pop_front();
+            dropped++;
+        }
+    }
 };
 
 void display_editor_stacks(TextEditor *editor) {
-    cout << "History:" << endl;
-    for (auto c : editor->history) 
-        cout << "  " << typeid(c).name() << " - " << &c << endl;
+    cout << "History (" << editor->memory_footprint() << " bytes, "
+         << editor->dropped << " dropped):" << endl;
+    for (auto &c : editor->history) 
+        cout << "  " << typeid(*c).name() << " - " << c.get() << endl;
         
     cout << "Undo:" << endl;
-    for (auto c : editor->undo_stack) 
-        cout << "  " << typeid(c).name() << " - " << &c << endl;
+    for (auto &c : editor->undo_stack) 
+        cout << "  " << typeid(*c).name() << " - " << c.get() << endl;
 };
 
-int main() {
+// Replays the same random inserts and deletes through the commands on the
+// piece table and on a plain string, and checks both end with the same text
+void benchmark_random_edits(size_t initial_size, int edits, int checked_edits) {
+    mt19937 rng(42);
+    Document doc;
+    string reference(initial_size, '.');
+    doc.insert_text(reference);
+    double string_ms = 0.0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < edits; i++) {
+        int size = int(doc.size());
+        if (size > 0 && rng() % 3 == 0) {
+            int position = rng() % size;
+            int length = 1 + rng() % 16;
+            DeleteTextCommand(doc, position, length).execute();
+            if (i < checked_edits) {
+                auto string_start = chrono::steady_clock::now();
+                reference.erase(position, length);
+                string_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - string_start).count();
+            }
+        } else {
+            int position = size > 0 ? rng() % (size + 1) : 0;
+            string text(1 + rng() % 8, char('a' + i % 26));
+            InsertTextCommand(doc, text, position).execute();
+            if (i < checked_edits) {
+                auto string_start = chrono::steady_clock::now();
+                reference.insert(position, text);
+                string_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - string_start).count();
+            }
+        }
+        if (i + 1 == checked_edits && doc.text() != reference) cout << "MISMATCH after " << checked_edits << " edits" << endl;
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << edits << " random edits: " << ms << " ms, " << doc.size() << " chars in "
+         << doc.piece_count() << " pieces" << endl;
+    cout << "  plain string, first " << checked_edits << " edits: " << string_ms << " ms" << endl;
+}
+
+// Types words one character at a time and sometimes deletes, with a small
+// history budget: the footprint must stay under the budget however long it runs
+void benchmark_long_session(int keystrokes, size_t budget) {
+    mt19937 rng(7);
+    TextEditor editor(budget);
+    size_t peak = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < keystrokes; i++) {
+        int size = int(editor._doc.size());
+        if (size > 8 && rng() % 50 == 0) {
+            editor.execute_command(make_unique<DeleteTextCommand>(editor._doc, size - 4, 4));
+        } else {
+            string key(1, rng() % 6 == 0 ? ' ' : char('a' + rng() % 26));
+            editor.execute_command(make_unique<InsertTextCommand>(editor._doc, key, size));
+        }
+        peak = max(peak, editor.memory_footprint());
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << keystrokes << " keystrokes with a " << budget << " byte budget: " << ms << " ms, "
+         << editor.history.size() << " commands kept, " << editor.dropped << " dropped, peak "
+         << peak << " bytes" << endl;
+}
+
+// Journals a typing session, then measures how long a fresh editor takes to
+// get back to the same text
+void benchmark_journal(const string &path, int keystrokes, size_t snapshot_every) {
+    remove(path.c_str());
+    remove((path + ".snap").c_str());
+    mt19937 rng(11);
+    string expected;
+    uint64_t fsyncs;
+    auto start = chrono::steady_clock::now();
+    {
+        TextEditor editor;
+        editor.open_journal(path, snapshot_every);
+        for (int i = 0; i < keystrokes; i++) {
+            int size = int(editor._doc.size());
+            if (size > 8 && rng() % 50 == 0) {
+                editor.execute_command(make_unique<DeleteTextCommand>(editor._doc, size - 4, 4));
+            } else {
+                string key(1, rng() % 6 == 0 ? ' ' : char('a' + rng() % 26));
+                editor.execute_command(make_unique<InsertTextCommand>(editor._doc, key, size));
+            }
+            if (i % 1000 == 0) editor.undo();
+        }
+        editor.journal->sync();
+        fsyncs = editor.journal->fsync_count();
+        expected = editor._doc.text();
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    TextEditor restored;
+    size_t replayed = restored.open_journal(path, snapshot_every);
+    double replay_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << keystrokes << " journaled keystrokes: " << ms << " ms, " << fsyncs << " fsyncs" << endl;
+    cout << "  replay: " << replay_ms << " ms, snapshot + " << replayed << " records"
+         << (restored._doc.text() == expected ? "" : " MISMATCH") << endl;
+    restored.journal.reset();
+    remove(path.c_str());
+    remove((path + ".snap").c_str());
+}
+
+int main(int argc, char *argv[]) {
     TextEditor editor;
     
-    InsertTextCommand command0 = InsertTextCommand(editor._doc, "Hello", 0);
-    editor.execute_command(command0);
+    editor.execute_command(make_unique<InsertTextCommand>(editor._doc, "Hello", 0));
     editor.show_document();
 
-    InsertTextCommand command1 = InsertTextCommand(editor._doc, " World", 5);
-    editor.execute_command(command1);
+    editor.execute_command(make_unique<InsertTextCommand>(editor._doc, " World", 5));
     editor.show_document();
 
     display_editor_stacks(&editor);
@@ -125,4 +786,13 @@ int main() {
     editor.show_document();
     display_editor_stacks(&editor);
 
+    // The benchmarks take minutes in a debug build, so they only run on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmarks" << endl;
+        return 0;
+    }
+
+    benchmark_random_edits(4 << 20, 1000000, 20000);
+    benchmark_long_session(1000000, 64 << 10);
+    benchmark_journal((filesystem::temp_directory_path() / "editor.journal").string(), 1000000, 100000);
 }
\ No newline at end of file
@@ -3,16 +3,266 @@
 #include <memory>
 #include <vector>
 #include <cctype>
+#include <cstdint>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <string_view>
+#include <charconv>
+#include <new>
+#include <map>
+#include <set>
+#include <tuple>
+#include <cstring>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <condition_variable>
+#include <functional>
+#include <cmath>
+#include <atomic>
+#include <exception>
+
+// SSE2 and AVX2 column kernels need GCC/Clang on x86-64; other builds
+// evaluate batches with plain loops
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS 1
+#endif
 
 using namespace std;
 
+// Variable bindings for a single evaluation
+struct Context {
+    double x = 0.0;
+    double y = 0.0;
+};
+
+// Input columns for batch evaluation, row i is (x[i], y[i])
+struct Columns {
+    const double* x;
+    const double* y;
+    size_t rows;
+};
+
+// Column kernels compute out[i] = out[i] op rhs[i] for a whole block of rows
+typedef void (*ColumnKernel)(double* out, const double* rhs, size_t n);
+
+#if HAS_X86_KERNELS
+#define DEFINE_SSE2_KERNEL(NAME, OP, INTRINSIC) \
+    static void NAME##_sse2(double* out, const double* rhs, size_t n) { \
+        size_t i = 0; \
+        for (; i + 2 <= n; i += 2) \
+            _mm_storeu_pd(out + i, INTRINSIC(_mm_loadu_pd(out + i), _mm_loadu_pd(rhs + i))); \
+        for (; i < n; i++) out[i] = out[i] OP rhs[i]; \
+    }
+
+#define DEFINE_AVX2_KERNEL(NAME, OP, INTRINSIC) \
+    __attribute__((target("avx2"))) static void NAME##_avx2(double* out, const double* rhs, size_t n) { \
+        size_t i = 0; \
+        for (; i + 8 <= n; i += 8) { \
+            __m256d a = INTRINSIC(_mm256_loadu_pd(out + i), _mm256_loadu_pd(rhs + i)); \
+            __m256d b = INTRINSIC(_mm256_loadu_pd(out + i + 4), _mm256_loadu_pd(rhs + i + 4)); \
+            _mm256_storeu_pd(out + i, a); \
+            _mm256_storeu_pd(out + i + 4, b); \
+        } \
+        for (; i < n; i++) out[i] = out[i] OP rhs[i]; \
+    }
+
+DEFINE_SSE2_KERNEL(add, +, _mm_add_pd)
+DEFINE_SSE2_KERNEL(sub, -, _mm_sub_pd)
+DEFINE_SSE2_KERNEL(mul, *, _mm_mul_pd)
+DEFINE_SSE2_KERNEL(div, /, _mm_div_pd)
+DEFINE_AVX2_KERNEL(add, +, _mm256_add_pd)
+DEFINE_AVX2_KERNEL(sub, -, _mm256_sub_pd)
+DEFINE_AVX2_KERNEL(mul, *, _mm256_mul_pd)
+DEFINE_AVX2_KERNEL(div, /, _mm256_div_pd)
+#else
+#define DEFINE_SCALAR_KERNEL(NAME, OP) \
+    static void NAME##_scalar(double* out, const double* rhs, size_t n) { \
+        for (size_t i = 0; i < n; i++) out[i] = out[i] OP rhs[i]; \
+    }
+
+DEFINE_SCALAR_KERNEL(add, +)
+DEFINE_SCALAR_KERNEL(sub, -)
+DEFINE_SCALAR_KERNEL(mul, *)
+DEFINE_SCALAR_KERNEL(div, /)
+#endif
+
+struct ColumnKernels {
+    const char* name;
+    ColumnKernel add, sub, mul, div;
+};
+
+// Best kernel set for this CPU, picked once on first use
+const ColumnKernels& column_kernels() {
+    static const ColumnKernels selected = [] {
+#if HAS_X86_KERNELS
+        if (__builtin_cpu_supports("avx2"))
+            return ColumnKernels{"avx2", add_avx2, sub_avx2, mul_avx2, div_avx2};
+        return ColumnKernels{"sse2", add_sse2, sub_sse2, mul_sse2, div_sse2};
+#else
+        return ColumnKernels{"scalar", add_scalar, sub_scalar, mul_scalar, div_scalar};
+#endif
+    }();
+    return selected;
+}
+
+// Bytecode for the stack machine: operands are pushed, operators pop two and push one
+enum class OpCode : uint8_t {
+    PUSH,
+    LOAD_X,
+    LOAD_Y,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    STORE_TEMP,  // copy the top of stack into a temporary, leaving it on the stack
+    LOAD_TEMP,
+    HALT
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t slot;  // only used by STORE_TEMP/LOAD_TEMP
+    double value;   // only used by PUSH
+};
+
+class Expression;
+class Optimizer;
+
+// Flat program produced by compiling an expression tree
+class Program {
+    struct SharedSlot {
+        uint32_t slot;
+        bool emitted;
+    };
+
+    vector<Instruction> code;
+    map<const Expression*, SharedSlot> shared_slots;
+    size_t depth = 0;
+    size_t max_depth = 0;
+
+public:
+    Program() = default;
+    // Nodes referenced from several parents are computed once and reloaded
+    explicit Program(const set<const Expression*>& shared_nodes) {
+        for (const Expression* node : shared_nodes) {
+            shared_slots[node] = {static_cast<uint32_t>(shared_slots.size()), false};
+        }
+    }
+
+    void emit(OpCode op, double value = 0.0, uint32_t slot = 0) {
+        code.push_back({op, slot, value});
+        if (op == OpCode::PUSH || op == OpCode::LOAD_X || op == OpCode::LOAD_Y || op == OpCode::LOAD_TEMP) {
+            depth++;
+            if (depth > max_depth) max_depth = depth;
+        } else if (op != OpCode::HALT && op != OpCode::STORE_TEMP) {
+            depth--;
+        }
+    }
+
+    // Compile a child node, going through its temporary when it is shared
+    void append(const Expression& node);
+
+    size_t size() const { return code.size(); }
+    size_t stack_size() const { return max_depth; }
+
+    // Programs must end with HALT, see compile()
+    double run(const Context& context = Context()) const;
+
+private:
+    double execute(double* stack, const Context& context) const;
+};
+
 // Abstract base class for Expressions
 class Expression {
 public:
     virtual ~Expression() = default;
-    virtual double interpret() const = 0;
+    double interpret() const { return interpret(Context()); }
+    virtual double interpret(const Context& context) const = 0;
+    // Emit the postfix bytecode for this subtree
+    virtual void compile(Program& program) const = 0;
+    // Evaluate a block of rows into out, using scratch_columns() temporary
+    // columns of columns.rows values each from scratch
+    virtual void interpret_batch(const Columns& columns, double* out, double* scratch) const = 0;
+    virtual size_t scratch_columns() const = 0;
+    // Rebuild this subtree through the optimizer, see Optimizer
+    virtual shared_ptr<Expression> optimize(Optimizer& optimizer) const = 0;
 };
 
+void Program::append(const Expression& node) {
+    auto shared = shared_slots.find(&node);
+    if (shared == shared_slots.end()) {
+        node.compile(*this);
+    } else if (shared->second.emitted) {
+        emit(OpCode::LOAD_TEMP, 0.0, shared->second.slot);
+    } else {
+        node.compile(*this);
+        emit(OpCode::STORE_TEMP, 0.0, shared->second.slot);
+        shared->second.emitted = true;
+    }
+}
+
+// Small stack on the caller frame for usual formulas, heap only for very deep ones
+// Temporaries are kept right after the stack in the same buffer.
+double Program::run(const Context& context) const {
+    const size_t INLINE_STACK = 64;
+    if (max_depth + shared_slots.size() > INLINE_STACK) {
+        vector<double> heap_stack(max_depth + shared_slots.size());
+        return execute(heap_stack.data(), context);
+    }
+    double inline_stack[INLINE_STACK];
+    return execute(inline_stack, context);
+}
+
+// Top of stack is cached in a local so most operations stay in registers.
+// With GCC/Clang every handler jumps straight to the next one (threaded code),
+// which predicts much better than a single shared switch.
+double Program::execute(double* stack, const Context& context) const {
+    double* sp = stack;  // values below the cached top
+    double acc = 0.0;    // cached top of stack
+    double* temps = stack + max_depth;
+    const Instruction* ip = code.data();
+#if defined(__GNUC__)
+    static void* const handlers[] = {&&op_push, &&op_load_x, &&op_load_y,
+                                     &&op_add, &&op_sub, &&op_mul, &&op_div,
+                                     &&op_store_temp, &&op_load_temp, &&op_halt};
+    #define DISPATCH() goto *handlers[static_cast<uint8_t>(ip->op)]
+    #define NEXT() do { ++ip; DISPATCH(); } while (0)
+    DISPATCH();
+op_push: *sp++ = acc; acc = ip->value; NEXT();
+op_load_x: *sp++ = acc; acc = context.x; NEXT();
+op_load_y: *sp++ = acc; acc = context.y; NEXT();
+op_add:  acc = *--sp + acc; NEXT();
+op_sub:  acc = *--sp - acc; NEXT();
+op_mul:  acc = *--sp * acc; NEXT();
+op_div:  acc = *--sp / acc; NEXT();
+op_store_temp: temps[ip->slot] = acc; NEXT();
+op_load_temp: *sp++ = acc; acc = temps[ip->slot]; NEXT();
+op_halt: return acc;
+    #undef NEXT
+    #undef DISPATCH
+#else
+    for (;; ++ip) {
+        switch (ip->op) {
+            case OpCode::PUSH: *sp++ = acc; acc = ip->value; break;
+            case OpCode::LOAD_X: *sp++ = acc; acc = context.x; break;
+            case OpCode::LOAD_Y: *sp++ = acc; acc = context.y; break;
+            case OpCode::ADD: acc = *--sp + acc; break;
+            case OpCode::SUB: acc = *--sp - acc; break;
+            case OpCode::MUL: acc = *--sp * acc; break;
+            case OpCode::DIV: acc = *--sp / acc; break;
+            case OpCode::STORE_TEMP: temps[ip->slot] = acc; break;
+            case OpCode::LOAD_TEMP: *sp++ = acc; acc = temps[ip->slot]; break;
+            case OpCode::HALT: return acc;
+        }
+    }
+#endif
+}
+
 // Terminal Expression for Numbers
 class Number : public Expression {
     double value;
@@ -20,9 +270,48 @@ class Number : public Expression {
 public:
     explicit Number(double value) : value(value) {}
 
-    double interpret() const override {
+    double get_value() const { return value; }
+
+    double interpret(const Context&) const override {
         return value;
     }
+
+    void compile(Program& program) const override {
+        program.emit(OpCode::PUSH, value);
+    }
+
+    void interpret_batch(const Columns& columns, double* out, double*) const override {
+        fill(out, out + columns.rows, value);
+    }
+
+    size_t scratch_columns() const override { return 0; }
+
+    shared_ptr<Expression> optimize(Optimizer& optimizer) const override;
+};
+
+// Terminal Expression for the variables x and y
+class Variable : public Expression {
+    char name;
+
+public:
+    explicit Variable(char name) : name(name) {}
+
+    double interpret(const Context& context) const override {
+        return name == 'x' ? context.x : context.y;
+    }
+
+    void compile(Program& program) const override {
+        program.emit(name == 'x' ? OpCode::LOAD_X : OpCode::LOAD_Y);
+    }
+
+    void interpret_batch(const Columns& columns, double* out, double*) const override {
+        const double* column = name == 'x' ? columns.x : columns.y;
+        copy(column, column + columns.rows, out);
+    }
+
+    size_t scratch_columns() const override { return 0; }
+
+    shared_ptr<Expression> optimize(Optimizer& optimizer) const override;
 };
 
 // Nonterminal Expression for Addition
@@ -33,9 +322,27 @@ public:
     Add(shared_ptr<Expression> left, shared_ptr<Expression> right)
         : left(move(left)), right(move(right)) {}
 
-    double interpret() const override {
-        return left->interpret() + right->interpret();
+    double interpret(const Context& context) const override {
+        return left->interpret(context) + right->interpret(context);
+    }
+
+    void compile(Program& program) const override {
+        program.append(*left);
+        program.append(*right);
+        program.emit(OpCode::ADD);
+    }
+
+    void interpret_batch(const Columns& columns, double* out, double* scratch) const override {
+        left->interpret_batch(columns, out, scratch);
+        right->interpret_batch(columns, scratch, scratch + columns.rows);
+        column_kernels().add(out, scratch, columns.rows);
     }
+
+    size_t scratch_columns() const override {
+        return max(left->scratch_columns(), 1 + right->scratch_columns());
+    }
+
+    shared_ptr<Expression> optimize(Optimizer& optimizer) const override;
 };
 
 // Nonterminal Expression for Subtraction
@@ -46,9 +353,27 @@ public:
     Subtract(shared_ptr<Expression> left, shared_ptr<Expression> right)
         : left(move(left)), right(move(right)) {}
 
-    double interpret() const override {
-        return left->interpret() - right->interpret();
+    double interpret(const Context& context) const override {
+        return left->interpret(context) - right->interpret(context);
+    }
+
+    void compile(Program& program) const override {
+        program.append(*left);
+        program.append(*right);
+        program.emit(OpCode::SUB);
+    }
+
+    void interpret_batch(const Columns& columns, double* out, double* scratch) const override {
+        left->interpret_batch(columns, out, scratch);
+        right->interpret_batch(columns, scratch, scratch + columns.rows);
+        column_kernels().sub(out, scratch, columns.rows);
+    }
+
+    size_t scratch_columns() const override {
+        return max(left->scratch_columns(), 1 + right->scratch_columns());
     }
+
+    shared_ptr<Expression> optimize(Optimizer& optimizer) const override;
 };
 
 // Nonterminal Expression for Multiplication
@@ -59,9 +384,27 @@ public:
     Multiply(shared_ptr<Expression> left, shared_ptr<Expression> right)
         : left(move(left)), right(move(right)) {}
 
-    double interpret() const override {
-        return left->interpret() * right->interpret();
+    double interpret(const Context& context) const override {
+        return left->interpret(context) * right->interpret(context);
+    }
+
+    void compile(Program& program) const override {
+        program.append(*left);
+        program.append(*right);
+        program.emit(OpCode::MUL);
+    }
+
+    void interpret_batch(const Columns& columns, double* out, double* scratch) const override {
+        left->interpret_batch(columns, out, scratch);
+        right->interpret_batch(columns, scratch, scratch + columns.rows);
+        column_kernels().mul(out, scratch, columns.rows);
     }
+
+    size_t scratch_columns() const override {
+        return max(left->scratch_columns(), 1 + right->scratch_columns());
+    }
+
+    shared_ptr<Expression> optimize(Optimizer& optimizer) const override;
 };
 
 // Nonterminal Expression for Division
@@ -72,9 +415,27 @@ public:
     Divide(shared_ptr<Expression> left, shared_ptr<Expression> right)
         : left(move(left)), right(move(right)) {}
 
-    double interpret() const override {
-        return left->interpret() / right->interpret();
+    double interpret(const Context& context) const override {
+        return left->interpret(context) / right->interpret(context);
+    }
+
+    void compile(Program& program) const override {
+        program.append(*left);
+        program.append(*right);
+        program.emit(OpCode::DIV);
     }
+
+    void interpret_batch(const Columns& columns, double* out, double* scratch) const override {
+        left->interpret_batch(columns, out, scratch);
+        right->interpret_batch(columns, scratch, scratch + columns.rows);
+        column_kernels().div(out, scratch, columns.rows);
+    }
+
+    size_t scratch_columns() const override {
+        return max(left->scratch_columns(), 1 + right->scratch_columns());
+    }
+
+    shared_ptr<Expression> optimize(Optimizer& optimizer) const override;
 };
 
 // Parser class to build the expression tree from a string
@@ -160,6 +521,9 @@ shared_ptr<Expression> Parser::parse_factor() {
     if (isdigit(token[0])) {
         consume_token();
         return make_shared<Number>(stod(token));
+    } else if (token == "x" || token == "y") {
+        consume_token();
+        return make_shared<Variable>(token[0]);
     } else if (token == "(") {
         consume_token();
         auto expression = parse_expression();
@@ -169,11 +533,809 @@ shared_ptr<Expression> Parser::parse_factor() {
     throw runtime_error("Unexpected token: " + token);
 }
 
-int main() {
+// Optimization pass run between Parser::parse() and evaluation:
+// - constant subtrees are folded into a single Number
+// - identities x-0, x*1, 1*x, x/1 are removed
+// - with fast_math set, x+0 and 0+x become x and x*0 and 0*x become 0; this
+//   gives up three IEEE results: -0+0 is +0 (folded to -0), inf*0 and nan*0
+//   are nan (folded to 0), and a negative x times 0 is -0 (folded to +0)
+// - structurally equal subtrees become one shared node (hash-consing), which
+//   compile() then evaluates once per run, see shared_nodes()
+class Optimizer {
+    bool fast_math;
+    map<uint64_t, shared_ptr<Expression>> numbers;  // keyed by bit pattern
+    map<char, shared_ptr<Expression>> variables;
+    map<tuple<OpCode, const Expression*, const Expression*>, shared_ptr<Expression>> binaries;
+    set<const Expression*> shared;
+
+    static const Number* as_number(const shared_ptr<Expression>& node) {
+        return dynamic_cast<const Number*>(node.get());
+    }
+
+    static bool is_number(const shared_ptr<Expression>& node, double value) {
+        const Number* number = as_number(node);
+        return number && number->get_value() == value;
+    }
+
+public:
+    explicit Optimizer(bool fast_math = false) : fast_math(fast_math) {}
+
+    shared_ptr<Expression> optimize(const Expression& expression) {
+        return expression.optimize(*this);
+    }
+
+    // Nodes reused by more than one parent in the optimized trees
+    const set<const Expression*>& shared_nodes() const { return shared; }
+
+    shared_ptr<Expression> number(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        shared_ptr<Expression>& slot = numbers[bits];
+        return slot ? slot : (slot = make_shared<Number>(value));
+    }
+
+    shared_ptr<Expression> variable(char name) {
+        shared_ptr<Expression>& slot = variables[name];
+        return slot ? slot : (slot = make_shared<Variable>(name));
+    }
+
+    shared_ptr<Expression> binary(OpCode op, shared_ptr<Expression> left, shared_ptr<Expression> right) {
+        const Number* l = as_number(left);
+        const Number* r = as_number(right);
+        if (l && r) {
+            double a = l->get_value(), b = r->get_value();
+            switch (op) {
+                case OpCode::ADD: return number(a + b);
+                case OpCode::SUB: return number(a - b);
+                case OpCode::MUL: return number(a * b);
+                case OpCode::DIV: return number(a / b);
+                default: break;
+            }
+        }
+
+        switch (op) {
+            case OpCode::ADD:
+                if (fast_math && (is_number(right, 0.0) || is_number(left, 0.0)))
+                    return is_number(right, 0.0) ? left : right;
+                break;
+            case OpCode::SUB:
+                // x - -0 turns -0 into +0, so only a positive zero is an identity
+                if (is_number(right, 0.0) && !signbit(as_number(right)->get_value())) return left;
+                break;
+            case OpCode::MUL:
+                if (is_number(right, 1.0)) return left;
+                if (is_number(left, 1.0)) return right;
+                if (fast_math && (is_number(left, 0.0) || is_number(right, 0.0))) return number(0.0);
+                break;
+            case OpCode::DIV:
+                if (is_number(right, 1.0)) return left;
+                break;
+            default:
+                break;
+        }
+
+        shared_ptr<Expression>& slot = binaries[make_tuple(op, left.get(), right.get())];
+        if (slot) {
+            shared.insert(slot.get());
+            return slot;
+        }
+        switch (op) {
+            case OpCode::ADD: slot = make_shared<Add>(left, right); break;
+            case OpCode::SUB: slot = make_shared<Subtract>(left, right); break;
+            case OpCode::MUL: slot = make_shared<Multiply>(left, right); break;
+            case OpCode::DIV: slot = make_shared<Divide>(left, right); break;
+            default: throw invalid_argument("Not a binary operator");
+        }
+        return slot;
+    }
+};
+
+shared_ptr<Expression> Number::optimize(Optimizer& optimizer) const {
+    return optimizer.number(value);
+}
+
+shared_ptr<Expression> Variable::optimize(Optimizer& optimizer) const {
+    return optimizer.variable(name);
+}
+
+shared_ptr<Expression> Add::optimize(Optimizer& optimizer) const {
+    return optimizer.binary(OpCode::ADD, left->optimize(optimizer), right->optimize(optimizer));
+}
+
+shared_ptr<Expression> Subtract::optimize(Optimizer& optimizer) const {
+    return optimizer.binary(OpCode::SUB, left->optimize(optimizer), right->optimize(optimizer));
+}
+
+shared_ptr<Expression> Multiply::optimize(Optimizer& optimizer) const {
+    return optimizer.binary(OpCode::MUL, left->optimize(optimizer), right->optimize(optimizer));
+}
+
+shared_ptr<Expression> Divide::optimize(Optimizer& optimizer) const {
+    return optimizer.binary(OpCode::DIV, left->optimize(optimizer), right->optimize(optimizer));
+}
+
+// Bump allocator: nodes are carved out of large blocks and all released at once
+class Arena {
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    vector<unique_ptr<char[]>> blocks;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    size_t used = 0;
+
+    void* allocate(size_t size, size_t alignment) {
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+        if (cursor == nullptr || aligned + size > reinterpret_cast<uintptr_t>(limit)) {
+            size_t block_size = max(BLOCK_SIZE, size + alignment);
+            blocks.emplace_back(new char[block_size]);
+            cursor = blocks.back().get();
+            limit = cursor + block_size;
+            aligned = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+        }
+        cursor = reinterpret_cast<char*>(aligned + size);
+        used += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Objects are never destroyed one by one, so they must not own resources
+    template <class T, class... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+    }
+
+    size_t bytes_used() const { return used; }
+    size_t block_count() const { return blocks.size(); }
+};
+
+// Non-owning handle to an arena node: no control block and no refcounting
+shared_ptr<Expression> borrow(Expression* node) {
+    return shared_ptr<Expression>(shared_ptr<Expression>(), node);
+}
+
+enum class TokenKind : uint8_t {
+    NUMBER,
+    VARIABLE,
+    PLUS,
+    MINUS,
+    STAR,
+    SLASH,
+    LEFT_PAREN,
+    RIGHT_PAREN,
+    END,
+    INVALID
+};
+
+// Token viewing straight into the source text
+struct Token {
+    TokenKind kind;
+    string_view text;
+};
+
+// Produces one token at a time, without copying the source
+class Lexer {
+    string_view source;
+    size_t position = 0;
+
+public:
+    explicit Lexer(string_view source) : source(source) {}
+
+    Token next() {
+        while (position < source.size() && isspace(static_cast<unsigned char>(source[position]))) position++;
+        if (position == source.size()) return {TokenKind::END, string_view()};
+
+        size_t start = position;
+        char ch = source[position];
+        if (isdigit(static_cast<unsigned char>(ch)) || ch == '.') {
+            while (position < source.size() &&
+                   (isdigit(static_cast<unsigned char>(source[position])) || source[position] == '.')) {
+                position++;
+            }
+            return {TokenKind::NUMBER, source.substr(start, position - start)};
+        }
+
+        position++;
+        string_view text = source.substr(start, 1);
+        switch (ch) {
+            case '+': return {TokenKind::PLUS, text};
+            case '-': return {TokenKind::MINUS, text};
+            case '*': return {TokenKind::STAR, text};
+            case '/': return {TokenKind::SLASH, text};
+            case '(': return {TokenKind::LEFT_PAREN, text};
+            case ')': return {TokenKind::RIGHT_PAREN, text};
+            case 'x': case 'y': return {TokenKind::VARIABLE, text};
+            default: return {TokenKind::INVALID, text};
+        }
+    }
+};
+
+// Same grammar as Parser, but tokens are string_views and every node lives in
+// the given Arena. The returned tree is valid as long as the Arena and the
+// source text are.
+class ArenaParser {
+    Lexer lexer;
+    Token token;
+    Arena& arena;
+
+    void consume_token() {
+        token = lexer.next();
+    }
+
+    template <class Node>
+    Expression* make_binary(Expression* left, Expression* right) {
+        return arena.create<Node>(borrow(left), borrow(right));
+    }
+
+    Expression* parse_expression();
+    Expression* parse_term();
+    Expression* parse_factor();
+
+public:
+    ArenaParser(string_view expression, Arena& arena) : lexer(expression), arena(arena) {
+        consume_token();
+    }
+
+    const Expression& parse() {
+        return *parse_expression();
+    }
+};
+
+Expression* ArenaParser::parse_expression() {
+    Expression* left = parse_term();
+    while (token.kind == TokenKind::PLUS || token.kind == TokenKind::MINUS) {
+        TokenKind op = token.kind;
+        consume_token();
+        Expression* right = parse_term();
+        left = op == TokenKind::PLUS ? make_binary<Add>(left, right) : make_binary<Subtract>(left, right);
+    }
+    return left;
+}
+
+Expression* ArenaParser::parse_term() {
+    Expression* left = parse_factor();
+    while (token.kind == TokenKind::STAR || token.kind == TokenKind::SLASH) {
+        TokenKind op = token.kind;
+        consume_token();
+        Expression* right = parse_factor();
+        left = op == TokenKind::STAR ? make_binary<Multiply>(left, right) : make_binary<Divide>(left, right);
+    }
+    return left;
+}
+
+Expression* ArenaParser::parse_factor() {
+    Token current = token;
+    if (current.kind == TokenKind::NUMBER) {
+        double value = 0.0;
+        from_chars_result parsed = from_chars(current.text.data(), current.text.data() + current.text.size(), value);
+        if (parsed.ec != errc()) throw runtime_error("Invalid number: " + string(current.text));
+        consume_token();
+        return arena.create<Number>(value);
+    } else if (current.kind == TokenKind::VARIABLE) {
+        consume_token();
+        return arena.create<Variable>(current.text[0]);
+    } else if (current.kind == TokenKind::LEFT_PAREN) {
+        consume_token();
+        Expression* expression = parse_expression();
+        consume_token();  // Consume ")"
+        return expression;
+    }
+    throw runtime_error("Unexpected token: " + string(current.text));
+}
+
+// Compile step: flatten the tree returned by Parser::parse() into bytecode
+Program compile(const Expression& expression, const set<const Expression*>& shared_nodes = {}) {
+    Program program(shared_nodes);
+    program.append(expression);
+    program.emit(OpCode::HALT);
+    return program;
+}
+
+// Evaluate one formula over whole columns, block by block so the
+// temporaries of every node stay in cache
+void evaluate_batch(const Expression& expression, const vector<double>& x,
+                    const vector<double>& y, vector<double>& out) {
+    if (x.size() != y.size()) throw invalid_argument("x and y columns differ in size");
+    const size_t BLOCK = 1024;
+    size_t rows = x.size();
+    out.resize(rows);
+    vector<double> scratch(expression.scratch_columns() * BLOCK);
+    for (size_t begin = 0; begin < rows; begin += BLOCK) {
+        Columns block = {x.data() + begin, y.data() + begin, min(BLOCK, rows - begin)};
+        expression.interpret_batch(block, out.data() + begin, scratch.data());
+    }
+}
+
+// Optimized tree plus its bytecode, ready to run
+struct CompiledExpression {
+    shared_ptr<Expression> tree;
+    Program program;
+};
+
+shared_ptr<const CompiledExpression> compile_expression(const string& expression) {
+    Optimizer optimizer;
+    shared_ptr<Expression> tree = optimizer.optimize(*Parser(expression).parse());
+    Program program = compile(*tree, optimizer.shared_nodes());
+    return make_shared<const CompiledExpression>(CompiledExpression{tree, move(program)});
+}
+
+// Thread-safe LRU cache from formula text to its compiled form. Formulas that
+// differ only in whitespace share an entry; the exact texts seen for an entry
+// are indexed too, so a repeated formula is found without running the Lexer.
+class ExpressionCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t size = 0;
+    };
+
+private:
+    static constexpr size_t MAX_ALIASES = 4;  // exact texts indexed per entry
+
+    struct Entry {
+        string key;             // normalized text
+        vector<string> aliases; // exact texts, other than key, that map here
+        shared_ptr<const CompiledExpression> compiled;
+    };
+
+    size_t capacity;
+    list<Entry> entries;  // most recently used first
+    unordered_map<string, list<Entry>::iterator> index;  // keys and aliases
+    Stats stats_;
+    mutable mutex lock;
+
+    // Caller holds lock
+    void add_alias(list<Entry>::iterator entry, const string& expression) {
+        if (expression == entry->key || entry->aliases.size() >= MAX_ALIASES) return;
+        if (index.emplace(expression, entry).second) entry->aliases.push_back(expression);
+    }
+
+public:
+    explicit ExpressionCache(size_t capacity) : capacity(max<size_t>(capacity, 1)) {}
+
+    // Tokens joined by single spaces: "1+2" and "1 + 2" share an entry, while
+    // "1 2" and "12" do not, since the space between them separates tokens
+    static string normalize(const string& expression) {
+        string key;
+        key.reserve(expression.size());
+        Lexer lexer(expression);
+        for (Token token = lexer.next(); token.kind != TokenKind::END; token = lexer.next()) {
+            if (!key.empty()) key += ' ';
+            key.append(token.text.data(), token.text.size());
+        }
+        return key;
+    }
+
+    // Parsing and compiling happen outside the lock, so a slow miss does not
+    // stall hits from other threads
+    shared_ptr<const CompiledExpression> get(const string& expression) {
+        {
+            lock_guard<mutex> guard(lock);
+            auto found = index.find(expression);
+            if (found != index.end()) {
+                stats_.hits++;
+                entries.splice(entries.begin(), entries, found->second);
+                return found->second->compiled;
+            }
+        }
+
+        string key = normalize(expression);
+        {
+            lock_guard<mutex> guard(lock);
+            auto found = index.find(key);
+            if (found != index.end()) {
+                stats_.hits++;
+                entries.splice(entries.begin(), entries, found->second);
+                add_alias(found->second, expression);
+                return found->second->compiled;
+            }
+            stats_.misses++;
+        }
+
+        shared_ptr<const CompiledExpression> compiled = compile_expression(expression);
+
+        lock_guard<mutex> guard(lock);
+        auto found = index.find(key);
+        if (found != index.end()) return found->second->compiled;  // another thread won the race
+        entries.push_front(Entry{key, {}, compiled});
+        index[key] = entries.begin();
+        add_alias(entries.begin(), expression);
+        if (entries.size() > capacity) {
+            const Entry& victim = entries.back();
+            for (const string& alias : victim.aliases) index.erase(alias);
+            index.erase(victim.key);
+            entries.pop_back();
+            stats_.evictions++;
+        }
+        return compiled;
+    }
+
+    Stats stats() const {
+        lock_guard<mutex> guard(lock);
+        Stats current = stats_;
+        current.size = entries.size();
+        return current;
+    }
+};
+
+// Fixed set of threads running parallel_for() loops. The range is cut into
+// chunks dealt out to per-worker deques; a worker pops its own chunks from the
+// back and, when empty, steals from the front of the others. The calling
+// thread works as worker 0.
+class WorkStealingPool {
+    struct Range {
+        size_t begin;
+        size_t end;
+    };
+
+    struct Worker {
+        mutex lock;
+        deque<Range> ranges;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    const function<void(size_t, size_t)>* task = nullptr;
+    mutex state_lock;
+    condition_variable wake;
+    condition_variable done;
+    size_t generation = 0;
+    size_t running = 0;
+    bool stopping = false;
+    exception_ptr error;  // first exception thrown by the task
+    atomic<bool> failed{false};
+
+    bool pop_local(size_t index, Range& range) {
+        Worker& worker = *workers[index];
+        lock_guard<mutex> guard(worker.lock);
+        if (worker.ranges.empty()) return false;
+        range = worker.ranges.back();
+        worker.ranges.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, Range& range) {
+        for (size_t i = 1; i < workers.size(); i++) {
+            Worker& victim = *workers[(thief + i) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (victim.ranges.empty()) continue;
+            range = victim.ranges.front();
+            victim.ranges.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    // No task creates new work, so once nothing is left to steal we are done.
+    // After a failure the remaining chunks are skipped.
+    void drain(size_t index) {
+        Range range;
+        while (!failed.load(memory_order_relaxed) && (pop_local(index, range) || steal(index, range))) {
+            try {
+                (*task)(range.begin, range.end);
+            } catch (...) {
+                lock_guard<mutex> guard(state_lock);
+                if (!error) error = current_exception();
+                failed = true;
+            }
+        }
+    }
+
+    void worker_loop(size_t index) {
+        size_t seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> guard(state_lock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            drain(index);
+            lock_guard<mutex> guard(state_lock);
+            if (--running == 0) done.notify_all();
+        }
+    }
+
+public:
+    explicit WorkStealingPool(size_t thread_count) {
+        thread_count = max<size_t>(thread_count, 1);
+        for (size_t i = 0; i < thread_count; i++) workers.emplace_back(new Worker());
+        for (size_t i = 1; i < thread_count; i++) threads.emplace_back(&WorkStealingPool::worker_loop, this, i);
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(state_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : threads) worker.join();
+    }
+
+    size_t size() const { return workers.size(); }
+
+    // Calls body(begin, end) over [0, count) in chunks of at most grain items.
+    // If body throws, the first exception is rethrown once every worker has
+    // stopped using body.
+    void parallel_for(size_t count, size_t grain, const function<void(size_t, size_t)>& body) {
+        grain = max<size_t>(grain, 1);
+        size_t chunks = (count + grain - 1) / grain;
+        // Contiguous chunks per worker keep neighbouring jobs on one core
+        for (size_t w = 0; w < workers.size(); w++) {
+            lock_guard<mutex> guard(workers[w]->lock);
+            size_t first = chunks * w / workers.size();
+            size_t last = chunks * (w + 1) / workers.size();
+            for (size_t c = last; c > first; c--) {
+                workers[w]->ranges.push_back({(c - 1) * grain, min(count, c * grain)});
+            }
+        }
+
+        {
+            lock_guard<mutex> guard(state_lock);
+            task = &body;
+            running = threads.size();
+            generation++;
+        }
+        wake.notify_all();
+        drain(0);
+
+        unique_lock<mutex> guard(state_lock);
+        done.wait(guard, [&] { return running == 0; });
+        task = nullptr;
+        if (error) {
+            for (auto& worker : workers) {
+                lock_guard<mutex> worker_guard(worker->lock);
+                worker->ranges.clear();
+            }
+            exception_ptr thrown = error;
+            error = nullptr;
+            failed = false;
+            rethrow_exception(thrown);
+        }
+    }
+};
+
+struct EvaluationJob {
+    shared_ptr<const CompiledExpression> expression;
+    Context context;
+};
+
+// results[i] only depends on jobs[i], so the output is the same for any
+// number of threads and any stealing order
+vector<double> evaluate_parallel(const vector<EvaluationJob>& jobs, WorkStealingPool& pool) {
+    vector<double> results(jobs.size());
+    pool.parallel_for(jobs.size(), 4096, [&jobs, &results](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) results[i] = jobs[i].expression->program.run(jobs[i].context);
+    });
+    return results;
+}
+
+void benchmark_tree_vs_bytecode(const Expression& tree, const Program& program, int iterations) {
+    volatile double sink = 0.0;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) sink = tree.interpret();
+    auto tree_time = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) sink = program.run();
+    auto vm_time = chrono::steady_clock::now() - start;
+
+    double tree_ns = chrono::duration<double, nano>(tree_time).count() / iterations;
+    double vm_ns = chrono::duration<double, nano>(vm_time).count() / iterations;
+    cout << "Tree-walking interpret(): " << tree_ns << " ns/eval" << endl;
+    cout << "Bytecode Program::run():  " << vm_ns << " ns/eval"
+         << " (x" << tree_ns / vm_ns << ")" << endl;
+    (void)sink;
+}
+
+void benchmark_batch(const Expression& tree, const Program& program, size_t rows) {
+    vector<double> x(rows), y(rows), out(rows), expected(rows);
+    for (size_t i = 0; i < rows; i++) {
+        x[i] = 0.5 * i;
+        y[i] = 1.0 + i % 7;
+    }
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < rows; i++) expected[i] = tree.interpret(Context{x[i], y[i]});
+    auto tree_time = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < rows; i++) expected[i] = program.run(Context{x[i], y[i]});
+    auto vm_time = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    evaluate_batch(tree, x, y, out);
+    auto batch_time = chrono::steady_clock::now() - start;
+
+    bool same = out == expected;
+    auto ns_per_row = [rows](chrono::steady_clock::duration d) {
+        return chrono::duration<double, nano>(d).count() / rows;
+    };
+    cout << "Batch of " << rows << " rows, " << column_kernels().name << " kernels"
+         << (same ? "" : " (MISMATCH)") << ":" << endl;
+    cout << "  per-row interpret(): " << ns_per_row(tree_time) << " ns/row" << endl;
+    cout << "  per-row run():       " << ns_per_row(vm_time) << " ns/row" << endl;
+    cout << "  evaluate_batch():    " << ns_per_row(batch_time) << " ns/row" << endl;
+}
+
+void benchmark_parsers(const vector<string>& formulas) {
+    volatile double sink = 0.0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string& formula : formulas) sink = Parser(formula).parse()->interpret();
+    auto heap_time = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    Arena arena;
+    for (const string& formula : formulas) sink = ArenaParser(formula, arena).parse().interpret();
+    auto arena_time = chrono::steady_clock::now() - start;
+
+    double heap_us = chrono::duration<double, micro>(heap_time).count();
+    double arena_us = chrono::duration<double, micro>(arena_time).count();
+    cout << "Parsing " << formulas.size() << " formulas:" << endl;
+    cout << "  Parser:      " << heap_us / 1000 << " ms" << endl;
+    cout << "  ArenaParser: " << arena_us / 1000 << " ms (x" << heap_us / arena_us << ", "
+         << arena.bytes_used() / 1024 << " KiB in " << arena.block_count() << " blocks)" << endl;
+    (void)sink;
+}
+
+void benchmark_optimizer(const string& formula, int iterations) {
+    shared_ptr<Expression> tree = Parser(formula).parse();
+    Optimizer optimizer;
+    shared_ptr<Expression> optimized = optimizer.optimize(*tree);
+    Program plain = compile(*tree);
+    Program folded = compile(*optimized, optimizer.shared_nodes());
+
+    Context context = {1.25, -3.5};
+    cout << "Optimizing '" << formula << "':" << endl;
+    cout << "  " << plain.size() << " -> " << folded.size() << " instructions, "
+         << optimizer.shared_nodes().size() << " shared subexpressions, result "
+         << plain.run(context) << " / " << folded.run(context) << endl;
+
+    volatile double sink = 0.0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) sink = plain.run(context);
+    auto plain_time = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) sink = folded.run(context);
+    auto folded_time = chrono::steady_clock::now() - start;
+
+    double plain_ns = chrono::duration<double, nano>(plain_time).count() / iterations;
+    double folded_ns = chrono::duration<double, nano>(folded_time).count() / iterations;
+    cout << "  run(): " << plain_ns << " ns -> " << folded_ns << " ns/eval" << endl;
+    (void)sink;
+}
+
+void benchmark_cache(const vector<string>& workload, size_t capacity) {
+    volatile double sink = 0.0;
+    Context context = {2, 3};
+
+    auto start = chrono::steady_clock::now();
+    for (const string& formula : workload) sink = compile_expression(formula)->program.run(context);
+    auto uncached_time = chrono::steady_clock::now() - start;
+
+    ExpressionCache cache(capacity);
+    start = chrono::steady_clock::now();
+    for (const string& formula : workload) sink = cache.get(formula)->program.run(context);
+    auto cached_time = chrono::steady_clock::now() - start;
+
+    ExpressionCache::Stats stats = cache.stats();
+    cout << "Cache over " << workload.size() << " requests, capacity " << capacity << ":" << endl;
+    cout << "  uncached: " << chrono::duration<double, milli>(uncached_time).count() << " ms" << endl;
+    cout << "  cached:   " << chrono::duration<double, milli>(cached_time).count() << " ms"
+         << " (hits " << stats.hits << ", misses " << stats.misses
+         << ", evictions " << stats.evictions << ")" << endl;
+    (void)sink;
+}
+
+void benchmark_parallel_scaling(ExpressionCache& cache, size_t job_count) {
+    vector<EvaluationJob> jobs;
+    jobs.reserve(job_count);
+    for (size_t i = 0; i < job_count; i++) {
+        string formula = to_string(i % 50) + " * x * x + y / ( x + " + to_string(i % 7 + 1) + " ) - 3";
+        jobs.push_back({cache.get(formula), Context{0.001 * i, 1.0 + i % 11}});
+    }
+
+    // Powers of two up to the core count, and the core count itself
+    size_t max_threads = max<size_t>(thread::hardware_concurrency(), 4);
+    vector<size_t> thread_counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    vector<double> reference;
+    double single_ms = 0.0;
+    cout << "Parallel evaluation of " << job_count << " jobs:" << endl;
+    for (size_t threads : thread_counts) {
+        WorkStealingPool pool(threads);
+        auto start = chrono::steady_clock::now();
+        vector<double> results = evaluate_parallel(jobs, pool);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (threads == 1) {
+            reference = results;
+            single_ms = ms;
+        }
+        cout << "  " << threads << " threads: " << ms << " ms (x" << single_ms / ms << ")"
+             << (results == reference ? "" : " MISMATCH") << endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
     string expression = "3 + 5 * ( 10 - 4 ) / 2";
     Parser parser(expression);
     shared_ptr<Expression> syntax_tree = parser.parse();
     double result = syntax_tree->interpret();
     cout << "The result of '" << expression << "' is " << result << endl;
+
+    shared_ptr<Expression> folded_tree = Optimizer().optimize(*syntax_tree);
+    cout << "Folded to a constant: " << (dynamic_cast<Number*>(folded_tree.get()) ? "yes" : "no") << endl;
+
+    Program program = compile(*syntax_tree);
+    cout << "Compiled to " << program.size() << " instructions, stack size "
+         << program.stack_size() << ", result " << program.run() << endl;
+
+    string formula = "x * 2 + y - ( x - 1 ) / ( y + 3 )";
+    shared_ptr<Expression> formula_tree = Parser(formula).parse();
+    Arena arena;
+    const Expression& arena_tree = ArenaParser(formula, arena).parse();
+    Context context = {4, 5};
+    cout << "Arena-parsed '" << formula << "' at x=4, y=5: " << arena_tree.interpret(context)
+         << " (heap-parsed: " << formula_tree->interpret(context) << ")" << endl;
+
+    // Mostly a hot set of 40 formulas, in two spacings, plus a cold tail
+    vector<string> workload;
+    for (int i = 0; i < 200000; i++) {
+        int id = i % 10 == 0 ? 100 + (i * 7919) % 1000 : (i * 31) % 40;
+        workload.push_back(i % 2 ? to_string(id) + " * x + y / ( 2 + " + to_string(id % 5) + " )"
+                                 : to_string(id) + "*x+y/(2+" + to_string(id % 5) + ")");
+    }
+
+    ExpressionCache shared_cache(64);
+    // Same workload from several threads
+    vector<thread> workers;
+    for (int t = 0; t < 4; t++) {
+        workers.emplace_back([&shared_cache, &workload, t] {
+            for (size_t i = t; i < 20000; i += 4) shared_cache.get(workload[i]);
+        });
+    }
+    for (thread& worker : workers) worker.join();
+    ExpressionCache::Stats stats = shared_cache.stats();
+    cout << "Shared cache from 4 threads: " << stats.hits << " hits, " << stats.misses << " misses, "
+         << stats.evictions << " evictions, " << stats.size << " entries" << endl;
+
+    // The benchmarks take minutes in a debug build, so they only run on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmarks" << endl;
+        return 0;
+    }
+
+    benchmark_tree_vs_bytecode(*syntax_tree, program, 5000000);
+
+    // Longer formula: the gap grows with the number of nodes
+    string long_expression = "1.5";
+    for (int i = 0; i < 32; i++) long_expression += " + 2 * ( 7 - 4 ) / 3";
+    shared_ptr<Expression> long_tree = Parser(long_expression).parse();
+    cout << "Long formula with " << compile(*long_tree).size() << " instructions:" << endl;
+    benchmark_tree_vs_bytecode(*long_tree, compile(*long_tree), 500000);
+
+    Program formula_program = compile(*formula_tree);
+    benchmark_batch(*formula_tree, formula_program, 4000000);
+
+    vector<string> formulas;
+    for (int i = 0; i < 20000; i++) {
+        formulas.push_back(to_string(i) + " * x + ( y - " + to_string(i % 13) + ".5 ) / 2 - 3 * ( x + 1 )");
+    }
+    benchmark_parsers(formulas);
+
+    benchmark_optimizer("( x * y + 1 ) * ( x * y + 1 ) + y * ( 3 + 5 * ( 10 - 4 ) / 2 ) * 1 - ( x * y + 1 ) / 2 + 0",
+                        5000000);
+
+    benchmark_cache(workload, 64);
+    benchmark_parallel_scaling(shared_cache, 4000000);
     return 0;
 }
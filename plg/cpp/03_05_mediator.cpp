@@ -1,9 +1,59 @@
 #include "dp_includes.h"
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <time.h>
+
+// Message timestamps. now_ns() is a raw monotonic clock read. formatted()
+// gives ctime()-style text; every thread keeps its own copy and formats again
+// only when the wall-clock second changes, so there is no shared buffer and
+// no lock. The second is read from the coarse clock where available.
+struct Timestamps {
+    static uint64_t now_ns() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static time_t wall_seconds() {
+#ifdef CLOCK_REALTIME_COARSE
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return ts.tv_sec;
+#else
+        return chrono::system_clock::to_time_t(chrono::system_clock::now());
+#endif
+    }
+
+    // Valid until the next call from the same thread
+    static const string& formatted() {
+        thread_local time_t cached_second = -1;
+        thread_local string cached;
+        time_t second = wall_seconds();
+        if (second != cached_second) {
+            char buffer[64];
+            tm local;
+#ifdef _WIN32
+            localtime_s(&local, &second);
+#else
+            localtime_r(&second, &local);
+#endif
+            // The layout of ctime(). msvcrt has no %e, so the day's leading
+            // zero becomes a space by hand
+            size_t length = strftime(buffer, sizeof(buffer), "%a %b %d %H:%M:%S %Y\n", &local);
+            if (length > 8 && buffer[8] == '0') buffer[8] = ' ';
+            cached.assign(buffer, length);
+            cached_second = second;
+        }
+        return cached;
+    }
+};
 
 string current_datetime() {
-    auto now = chrono::system_clock::now();
-    time_t datetime = chrono::system_clock::to_time_t(now);
-    return ctime(&datetime);
+    return Timestamps::formatted();
 }
 
 // to be declared first to avoid circular-reference issues
@@ -27,11 +77,221 @@ struct ChatRoom {
 
 void User::send(string message) { _chat->show_message(*this, message); };
 
-int main() {
+// Message shared by every member of a room, it is never copied per member
+struct ChatPayload {
+    string sender;
+    string text;
+    uint64_t sent_ns;
+};
+typedef shared_ptr<const ChatPayload> ChatMessage;
+
+// Bounded multi-producer single-consumer queue (Vyukov style): every slot
+// carries a sequence number telling producers and the consumer whose turn it is
+class Inbox {
+    struct Slot {
+        atomic<size_t> sequence;
+        ChatMessage message;
+    };
+    vector<Slot> _slots;
+    size_t _mask;
+    alignas(64) atomic<size_t> _tail{0};
+    alignas(64) size_t _head = 0;
+
+public:
+    // capacity is rounded up to a power of two
+    explicit Inbox(size_t capacity=64) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        _slots = vector<Slot>(size);
+        _mask = size - 1;
+        for (size_t i = 0; i < size; i++) _slots[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    // False when full
+    bool push(const ChatMessage& message) {
+        size_t pos = _tail.load(memory_order_relaxed);
+        for (;;) {
+            Slot& slot = _slots[pos & _mask];
+            intptr_t diff = intptr_t(slot.sequence.load(memory_order_acquire)) - intptr_t(pos);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _tail.load(memory_order_relaxed);
+            }
+        }
+        Slot& slot = _slots[pos & _mask];
+        slot.message = message;
+        slot.sequence.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    // Only the owner of the inbox may pop
+    bool pop(ChatMessage& message) {
+        Slot& slot = _slots[_head & _mask];
+        if (slot.sequence.load(memory_order_acquire) != _head + 1) return false;
+        message = move(slot.message);
+        slot.sequence.store(_head + _mask + 1, memory_order_release);
+        _head++;
+        return true;
+    }
+};
+
+// Mediator for many rooms at once. post() hands a message to the inbox of
+// every member of the room; when an inbox is full the sender waits for its
+// owner to catch up, so slow readers push back on senders instead of
+// growing memory. The wait is bounded by max_wait per post(), since the room
+// stays locked against leave() meanwhile; inboxes still full after that miss
+// the message. The sender's own inbox is skipped, so a member that posts and
+// reads on one thread does not wait on itself.
+class ChatServer {
+    struct Room {
+        shared_mutex lock;
+        vector<Inbox*> members;
+    };
+    vector<unique_ptr<Room>> _rooms;
+    chrono::steady_clock::duration _max_wait;
+
+public:
+    explicit ChatServer(size_t room_count, chrono::steady_clock::duration max_wait=chrono::milliseconds(10)) :
+        _max_wait(max_wait) {
+        for (size_t i = 0; i < room_count; i++) _rooms.emplace_back(new Room());
+    }
+
+    size_t room_count() const { return _rooms.size(); }
+
+    void join(size_t room, Inbox& inbox) {
+        unique_lock<shared_mutex> guard(_rooms[room]->lock);
+        _rooms[room]->members.push_back(&inbox);
+    }
+
+    void leave(size_t room, Inbox& inbox) {
+        unique_lock<shared_mutex> guard(_rooms[room]->lock);
+        auto& members = _rooms[room]->members;
+        members.erase(remove(members.begin(), members.end(), &inbox), members.end());
+    }
+
+    // Returns the number of members the message was dropped for
+    size_t post(size_t room, const string& sender, const string& text, const Inbox* own=nullptr) {
+        ChatMessage message = make_shared<const ChatPayload>(ChatPayload{sender, text, Timestamps::now_ns()});
+        shared_lock<shared_mutex> guard(_rooms[room]->lock);
+        size_t dropped = 0;
+        bool waiting = false;
+        chrono::steady_clock::time_point deadline;
+        for (Inbox* inbox : _rooms[room]->members) {
+            if (inbox == own) continue;
+            while (!inbox->push(message)) {
+                auto now = chrono::steady_clock::now();
+                if (!waiting) {
+                    deadline = now + _max_wait;
+                    waiting = true;
+                } else if (now >= deadline) {
+                    dropped++;
+                    break;
+                }
+                this_thread::yield();
+            }
+        }
+        return dropped;
+    }
+};
+
+// senders threads post to random rooms while readers threads drain all inboxes
+void benchmark_server(size_t rooms, size_t room_size, int senders, int readers, int messages_per_sender) {
+    ChatServer server(rooms, chrono::seconds(1));  // measures backpressure, so senders wait rather than drop
+    vector<unique_ptr<Inbox>> inboxes;
+    for (size_t room = 0; room < rooms; room++) {
+        for (size_t m = 0; m < room_size; m++) {
+            inboxes.emplace_back(new Inbox(32));
+            server.join(room, *inboxes.back());
+        }
+    }
+
+    size_t expected = size_t(senders) * messages_per_sender * room_size;
+    atomic<size_t> delivered{0};
+    atomic<size_t> dropped{0};
+    vector<vector<uint32_t>> latencies(readers);
+    vector<thread> threads;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < readers; r++) {
+        threads.emplace_back([&, r] {
+            ChatMessage message;
+            latencies[r].reserve(expected / readers + 1);
+            while (delivered.load(memory_order_relaxed) + dropped.load(memory_order_relaxed) < expected) {
+                size_t got = 0;
+                for (size_t i = r; i < inboxes.size(); i += readers) {
+                    while (inboxes[i]->pop(message)) {
+                        latencies[r].push_back(uint32_t(min<uint64_t>(Timestamps::now_ns() - message->sent_ns, UINT32_MAX)));
+                        got++;
+                    }
+                }
+                if (got) delivered.fetch_add(got, memory_order_relaxed);
+                else this_thread::yield();
+            }
+        });
+    }
+    for (int t = 0; t < senders; t++) {
+        threads.emplace_back([&, t] {
+            string name = "Sender" + to_string(t);
+            size_t missed = 0;
+            for (int i = 0; i < messages_per_sender; i++) missed += server.post((t * 7919 + i) % rooms, name, "Hello room!");
+            dropped.fetch_add(missed, memory_order_relaxed);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<uint32_t> all;
+    for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    sort(all.begin(), all.end());
+    cout << "  " << rooms << " rooms x " << room_size << " members, " << senders << " senders: "
+         << size_t(delivered / seconds) << " deliveries/s, latency p50 " << all[all.size() / 2] / 1000.0
+         << " us, p99 " << all[all.size() * 99 / 100] / 1000.0 << " us";
+    if (dropped) cout << ", " << dropped << " dropped";
+    cout << endl;
+}
+
+// Per-call cost of the old ctime() path against the cached one
+void benchmark_timestamps(int calls) {
+    volatile size_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++) {
+        time_t datetime = chrono::system_clock::to_time_t(chrono::system_clock::now());
+        sink += string(ctime(&datetime)).size();
+    }
+    double ctime_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / calls;
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++) sink += current_datetime().size();
+    double cached_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / calls;
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++) sink += Timestamps::now_ns() & 1;
+    double raw_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / calls;
+
+    cout << "Timestamps over " << calls << " calls: ctime " << ctime_ns << " ns, cached " << cached_ns
+         << " ns, raw " << raw_ns << " ns" << endl;
+}
+
+int main(int argc, char *argv[]) {
     ChatRoom *chat = new ChatRoom();
     User user1 ("Batman", chat);
     User user2 ("Robin", chat);
 
     user2.send("Hello Bat!");
     user1.send("WTF r u doin?!");
+
+    // The benchmarks take minutes in a debug build, so they only run on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmarks" << endl;
+        return 0;
+    }
+
+    benchmark_timestamps(2000000);
+
+    cout << "Chat server load:" << endl;
+    for (size_t room_size : {4, 16, 64}) {
+        for (int senders : {1, 2, 4}) benchmark_server(4096 / room_size, room_size, senders, 2, 20000);
+    }
 }
\ No newline at end of file
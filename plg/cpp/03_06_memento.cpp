@@ -1,36 +1,382 @@
 #include "dp_includes.h"
+#include <memory>
+#include <unordered_set>
+#include <algorithm>
+#include <random>
+#include <deque>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <stdexcept>
+#include <cstdio>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <unistd.h>
+
+// Fixed-size pieces of a saved state. Chunks are immutable once saved, so
+// consecutive snapshots share every chunk the edits did not touch.
+typedef shared_ptr<const string> Chunk;
+const size_t CHUNK_SIZE = 4096;
 
 struct Memento {
     string _state;
+    vector<Chunk> _chunks;  // used instead of _state when saved by save_shared()
+    bool _chunked = false;
     Memento(string state) : _state(state) {}
-    string get_state() {return _state;}
+    Memento(vector<Chunk> chunks) : _chunks(move(chunks)), _chunked(true) {}
+    string get_state() {
+        if (!_chunked) return _state;
+        string state;
+        state.reserve(_chunks.size() * CHUNK_SIZE);
+        for (auto &chunk : _chunks) state += *chunk;
+        return state;
+    }
+    // Bytes held by this memento. Chunks already in seen belong to another
+    // memento and are not counted again.
+    size_t footprint(unordered_set<const string*> &seen) const {
+        size_t bytes = sizeof(*this) + _state.capacity() + _chunks.capacity() * sizeof(Chunk);
+        for (auto &chunk : _chunks) {
+            if (seen.insert(chunk.get()).second) bytes += sizeof(string) + chunk->capacity();
+        }
+        return bytes;
+    }
 };
 
 struct Editor {
     string _content;
-    void type(string s) {_content += s;}
+    vector<Chunk> _saved;  // chunks of the last save_shared()
+    size_t _dirty_from = 0;  // content before this offset matches _saved
+    void type(string s) {
+        _dirty_from = min(_dirty_from, _content.size());
+        _content += s;
+    }
     string get_content() {return _content;}
     Memento save() {return Memento(_content);}
-    void restore(Memento &mem) {_content = mem.get_state();};
+    // Only the chunks touched since the previous save_shared() are copied
+    Memento save_shared() {
+        size_t chunks = (_content.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        size_t clean = min(_dirty_from / CHUNK_SIZE, _saved.size());
+        _saved.resize(min(clean, chunks));
+        for (size_t i = _saved.size(); i < chunks; i++) {
+            _saved.push_back(make_shared<const string>(_content, i * CHUNK_SIZE, CHUNK_SIZE));
+        }
+        _dirty_from = _content.size();
+        return Memento(_saved);
+    }
+    void restore(Memento &mem) {
+        _content = mem.get_state();
+        _saved = mem._chunks;
+        _dirty_from = mem._chunked ? _content.size() : 0;
+    };
 };
 
+// LZ4-style block compression: a token byte holds the literal count and the
+// match length - 4 in its two nibbles (15 means more length bytes follow,
+// each adding up to 255), then the literals, then a 2-byte match offset.
+// The last sequence has literals only.
+void put_length(string &out, size_t length) {
+    for (; length >= 255; length -= 255) out += char(255);
+    out += char(length);
+}
+
+string lz_compress(const string &in) {
+    const size_t MIN_MATCH = 4;
+    const size_t HASH_BITS = 14;
+    vector<uint32_t> table(size_t(1) << HASH_BITS, UINT32_MAX);
+    string out;
+    out.reserve(in.size() / 2 + 16);
+    size_t anchor = 0, i = 0;
+    auto read32 = [&](size_t at) { uint32_t v; memcpy(&v, in.data() + at, 4); return v; };
+    while (i + MIN_MATCH <= in.size()) {
+        uint32_t hash = (read32(i) * 2654435761u) >> (32 - HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = uint32_t(i);
+        if (candidate == UINT32_MAX || i - candidate > 0xffff || read32(candidate) != read32(i)) {
+            i++;
+            continue;
+        }
+        size_t length = MIN_MATCH;
+        while (i + length < in.size() && in[candidate + length] == in[i + length]) length++;
+
+        size_t literals = i - anchor;
+        size_t match = length - MIN_MATCH;
+        out += char((min<size_t>(literals, 15) << 4) | min<size_t>(match, 15));
+        if (literals >= 15) put_length(out, literals - 15);
+        out.append(in, anchor, literals);
+        size_t offset = i - candidate;
+        out += char(offset & 0xff);
+        out += char(offset >> 8);
+        if (match >= 15) put_length(out, match - 15);
+        i += length;
+        anchor = i;
+    }
+    size_t literals = in.size() - anchor;
+    out += char(min<size_t>(literals, 15) << 4);
+    if (literals >= 15) put_length(out, literals - 15);
+    out.append(in, anchor, literals);
+    return out;
+}
+
+string lz_decompress(const char *in, size_t size, size_t raw_size) {
+    string out;
+    out.reserve(raw_size);
+    const char *end = in + size;
+    auto get_length = [&](size_t length) {
+        if (length != 15) return length;
+        uint8_t byte;
+        do {
+            byte = uint8_t(*in++);
+            length += byte;
+        } while (byte == 255);
+        return length;
+    };
+    while (in < end) {
+        uint8_t token = uint8_t(*in++);
+        size_t literals = get_length(token >> 4);
+        out.append(in, literals);
+        in += literals;
+        if (in >= end) break;
+        size_t offset = uint8_t(in[0]) | (size_t(uint8_t(in[1])) << 8);
+        in += 2;
+        size_t length = get_length(token & 15) + 4;
+        size_t from = out.size() - offset;
+        if (offset >= length) {
+            out.append(out, from, length);
+        } else {
+            for (size_t k = 0; k < length; k++) out += out[from + k];  // overlapping run
+        }
+    }
+    return out;
+}
+
+// Snapshots in three tiers: the newest hot_count stay as they are, older ones
+// are compressed in RAM, and once compressed data passes compressed_budget the
+// oldest of it moves to an anonymous temporary file, read back through mmap
+// (with plain reads on Windows). The budget covers the compressed tier only:
+// RAM use is the hot_count newest snapshots, chunked ones, and up to
+// compressed_budget bytes of compressed ones.
+// Chunked mementos are never compressed: most of their chunks are shared with
+// newer snapshots, so compressing them one by one would only add copies.
 struct History {
-    vector<Memento> _mementos;
-    History() {_mementos={};}
-    void push(Memento mem) {_mementos.push_back(mem);}
+    enum Tier { HOT, COMPRESSED, SPILLED };
+    struct Entry {
+        Memento memento;
+        Tier tier;
+        string compressed;
+        size_t raw_size;
+        size_t offset;  // in the spill file
+        size_t length;
+    };
+
+    deque<Entry> _entries;
+    size_t _hot_count;
+    size_t _compressed_budget;
+    size_t _compressed_bytes = 0;
+    size_t _spilled_bytes = 0;
+    size_t _spill_cursor = 0;  // entries before it are spilled or chunked
+    FILE *_spill = nullptr;
+    char *_map = nullptr;
+    size_t _map_size = 0;
+
+    History(size_t hot_count=16, size_t compressed_budget=64 << 20) :
+        _hot_count(hot_count), _compressed_budget(compressed_budget) {}
+    ~History() {
+#ifndef _WIN32
+        if (_map) munmap(_map, _map_size);
+#endif
+        if (_spill) fclose(_spill);
+    }
+    History(const History&) = delete;
+    History& operator=(const History&) = delete;
+
+    void push(Memento mem) {
+        _entries.push_back({move(mem), HOT, "", 0, 0, 0});
+        if (_entries.size() > _hot_count) cool(_entries[_entries.size() - 1 - _hot_count]);
+        while (_compressed_bytes > _compressed_budget && _spill_cursor < _entries.size()) {
+            Entry &entry = _entries[_spill_cursor++];
+            if (entry.tier == COMPRESSED) spill(entry);
+        }
+    }
     Memento pop(){
-        if (_mementos.size()==0) return Memento("");
-        Memento mem = _mementos.back();
-        _mementos.pop_back();
+        if (_entries.size()==0) return Memento("");
+        Entry &entry = _entries.back();
+        Memento mem = entry.tier == HOT ? move(entry.memento) : Memento(load(entry));
+        if (entry.tier == COMPRESSED) _compressed_bytes -= entry.compressed.size();
+        if (entry.tier == SPILLED) {
+            // Spilled entries are written oldest first, so this one ends the file
+            _spilled_bytes -= entry.length;
+            if (ftruncate(fileno(_spill), entry.offset) != 0) throw runtime_error("cannot shrink spill file");
+        }
+        _entries.pop_back();
+        _spill_cursor = min(_spill_cursor, _entries.size());
         return mem;
     };
+    // Any snapshot, newest last, without removing it
+    Memento at(size_t index) {
+        Entry &entry = _entries[index];
+        return entry.tier == HOT ? entry.memento : Memento(load(entry));
+    }
+    size_t size() const { return _entries.size(); }
+    size_t spilled_bytes() const { return _spilled_bytes; }
+    // Bytes held in RAM, spilled snapshots excluded
+    size_t footprint() const {
+        unordered_set<const string*> seen;
+        size_t bytes = sizeof(*this);
+        for (auto &entry : _entries) bytes += sizeof(Entry) - sizeof(Memento) + entry.memento.footprint(seen) + entry.compressed.capacity();
+        return bytes;
+    }
+
+private:
+    void cool(Entry &entry) {
+        if (entry.tier != HOT || entry.memento._chunked) return;
+        entry.raw_size = entry.memento._state.size();
+        entry.compressed = lz_compress(entry.memento._state);
+        entry.compressed.shrink_to_fit();
+        string().swap(entry.memento._state);
+        entry.tier = COMPRESSED;
+        _compressed_bytes += entry.compressed.size();
+    }
+
+    void spill(Entry &entry) {
+        if (!_spill) {
+            _spill = tmpfile();  // removed automatically once closed
+            if (!_spill) throw runtime_error("cannot create spill file");
+        }
+        entry.offset = _spilled_bytes;
+        entry.length = entry.compressed.size();
+#ifndef _WIN32
+        if (pwrite(fileno(_spill), entry.compressed.data(), entry.length, entry.offset) != ssize_t(entry.length))
+            throw runtime_error("cannot write spill file");
+#else
+        if (fseek(_spill, long(entry.offset), SEEK_SET) != 0
+            || fwrite(entry.compressed.data(), 1, entry.length, _spill) != entry.length || fflush(_spill) != 0)
+            throw runtime_error("cannot write spill file");
+#endif
+        _spilled_bytes += entry.length;
+        _compressed_bytes -= entry.length;
+        string().swap(entry.compressed);
+        entry.tier = SPILLED;
+    }
+
+    string load(const Entry &entry) {
+        if (entry.tier == COMPRESSED) return lz_decompress(entry.compressed.data(), entry.compressed.size(), entry.raw_size);
+#ifndef _WIN32
+        if (entry.offset + entry.length > _map_size) {
+            if (_map) munmap(_map, _map_size);
+            _map_size = _spilled_bytes;
+            void *map = mmap(nullptr, _map_size, PROT_READ, MAP_SHARED, fileno(_spill), 0);
+            if (map == MAP_FAILED) {
+                _map = nullptr;
+                _map_size = 0;
+                throw runtime_error("cannot map spill file");
+            }
+            _map = static_cast<char*>(map);
+        }
+        return lz_decompress(_map + entry.offset, entry.length, entry.raw_size);
+#else
+        string compressed(entry.length, '\0');
+        if (fseek(_spill, long(entry.offset), SEEK_SET) != 0
+            || fread(&compressed[0], 1, entry.length, _spill) != entry.length)
+            throw runtime_error("cannot read spill file");
+        return lz_decompress(compressed.data(), entry.length, entry.raw_size);
+#endif
+    }
 };
 
 void display_content(string con) {
     cout << "Current content: " << con << endl;
 };
 
-int main() {
+// Types saves_count sentences, saving after each one, then restores random
+// older states, once with full copies and once with shared chunks
+void benchmark_snapshots(int saves_count, int restores) {
+    // Everything stays hot so only the memento modes are compared
+    History full(SIZE_MAX), shared(SIZE_MAX);
+    Editor full_editor, shared_editor;
+    double full_save_ms = 0.0, shared_save_ms = 0.0;
+    for (int i = 0; i < saves_count; i++) {
+        string sentence = "This is sentence number " + to_string(i) + ". ";
+        full_editor.type(sentence);
+        shared_editor.type(sentence);
+
+        auto start = chrono::steady_clock::now();
+        full.push(full_editor.save());
+        full_save_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        shared.push(shared_editor.save_shared());
+        shared_save_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    size_t document_size = full_editor.get_content().size();
+    mt19937 rng(3);
+    bool match = true;
+    double full_restore_ms = 0.0, shared_restore_ms = 0.0;
+    for (int i = 0; i < restores; i++) {
+        size_t index = rng() % saves_count;
+
+        auto start = chrono::steady_clock::now();
+        full_editor.restore(full._entries[index].memento);
+        full_restore_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        shared_editor.restore(shared._entries[index].memento);
+        shared_restore_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        match = match && full_editor.get_content() == shared_editor.get_content();
+    }
+
+    cout << saves_count << " saves of a " << document_size << " byte document:" << endl;
+    cout << "  full copy: " << full.footprint() / 1024 << " KiB, save " << full_save_ms * 1000 / saves_count
+         << " us, restore " << full_restore_ms * 1000 / restores << " us" << endl;
+    cout << "  shared:    " << shared.footprint() / 1024 << " KiB, save " << shared_save_ms * 1000 / saves_count
+         << " us, restore " << shared_restore_ms * 1000 / restores << " us"
+         << (match ? "" : " MISMATCH") << endl;
+}
+
+// Saves a long session of full copies into a tiered History and reads older
+// snapshots back from every tier
+void benchmark_tiers(int saves_count, size_t hot_count, size_t compressed_budget, int reads) {
+    Editor editor;
+    History history(hot_count, compressed_budget);
+    size_t raw_bytes = 0;
+    vector<size_t> sizes;  // snapshot i is the first sizes[i] bytes of the final text
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < saves_count; i++) {
+        editor.type("Entry " + to_string(i * 7919 % 10007) + " was edited at step " + to_string(i) + ". ");
+        raw_bytes += editor.get_content().size();
+        sizes.push_back(editor.get_content().size());
+        history.push(editor.save());
+    }
+    double push_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    string last = editor.get_content();
+    auto expected = [&](size_t index, const string &state) {
+        return state.size() == sizes[index] && last.compare(0, sizes[index], state) == 0;
+    };
+
+    mt19937 rng(5);
+    bool match = true;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < reads; i++) {
+        size_t index = rng() % saves_count;
+        match = match && expected(index, history.at(index).get_state());
+    }
+    double read_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    size_t footprint = history.footprint(), spilled = history.spilled_bytes();
+
+    // Pops every tier, newest first, which also shrinks the spill file
+    for (size_t index = history.size(); index-- > 0;) match = match && expected(index, history.pop().get_state());
+
+    cout << saves_count << " full snapshots, " << raw_bytes / 1024 << " KiB uncompressed:" << endl;
+    cout << "  in RAM " << footprint / 1024 << " KiB (compressed budget " << compressed_budget / 1024 << " KiB), spilled "
+         << spilled / 1024 << " KiB" << endl;
+    cout << "  push " << push_ms * 1000 / saves_count << " us, random read " << read_ms * 1000 / reads << " us"
+         << (match ? "" : " MISMATCH") << endl;
+}
+
+int main(int argc, char *argv[]) {
     Editor editor;
     History history;
     editor.type("This is the FIRST sentence. ");
@@ -44,4 +390,13 @@ int main() {
     Memento mem = history.pop();
     editor.restore(mem);
     display_content(editor.get_content());
-}
\ No newline at end of file
+
+    // The benchmarks take minutes in a debug build, so they only run on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmarks" << endl;
+        return 0;
+    }
+
+    benchmark_snapshots(3000, 1000);
+    benchmark_tiers(3000, 16, 4 << 20, 1000);
+}
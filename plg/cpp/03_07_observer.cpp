@@ -1,23 +1,269 @@
 #include "dp_includes.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <climits>
+#include <stdexcept>
+#include <algorithm>
 
+// Epoch-based reclamation shared by all subjects. A notifying thread marks
+// its slot with the epoch it started in; an observer list replaced at epoch E
+// is freed once every marked slot is past E. Readers never take a lock.
+class EpochDomain {
+public:
+    static const size_t MAX_READERS = 256;
+
+private:
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch{0};  // 0 when the owner is not reading
+        atomic<bool> taken{false};
+        unsigned depth = 0;  // nested reads, only touched by the owner
+    };
+
+    atomic<uint64_t> _epoch{1};
+    Slot _slots[MAX_READERS];
+
+    // Gives the slot back when its thread exits
+    struct SlotOwner {
+        Slot* slot = nullptr;
+        ~SlotOwner() { if (slot) slot->taken.store(false, memory_order_release); }
+    };
+
+    Slot& local_slot() {
+        thread_local SlotOwner owner;
+        if (!owner.slot) {
+            for (Slot& slot : _slots) {
+                bool free = false;
+                if (slot.taken.compare_exchange_strong(free, true)) {
+                    owner.slot = &slot;
+                    break;
+                }
+            }
+            if (!owner.slot) throw runtime_error("too many notifying threads");
+        }
+        return *owner.slot;
+    }
+
+public:
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    void enter() {
+        Slot& slot = local_slot();
+        if (slot.depth++ == 0) slot.epoch.store(_epoch.load());
+    }
+
+    void exit() {
+        Slot& slot = local_slot();
+        if (--slot.depth == 0) slot.epoch.store(0, memory_order_release);
+    }
+
+    // Epoch to tag an object unlinked just before this call
+    uint64_t retire_epoch() { return _epoch.fetch_add(1); }
+
+    uint64_t oldest_reader() {
+        uint64_t oldest = UINT64_MAX;
+        for (Slot& slot : _slots) {
+            uint64_t epoch = slot.epoch.load();
+            if (epoch != 0) oldest = min(oldest, epoch);
+        }
+        return oldest;
+    }
+
+    // Waits until no reader can still see what was retired at epoch.
+    // Must not be called while reading.
+    void synchronize(uint64_t epoch) {
+        while (oldest_reader() <= epoch) this_thread::yield();
+    }
+};
+
+struct ReadGuard {
+    ReadGuard() { EpochDomain::instance().enter(); }
+    ~ReadGuard() { EpochDomain::instance().exit(); }
+};
+
+template <typename Event>
 struct Observer {
-    virtual void update()=0;
+    virtual ~Observer() {};
+    virtual void update(const Event& event)=0;
+    // Bursts arrive as one call; override when the events can be handled together
+    virtual void update_batch(const vector<Event>& events) {
+        for (const Event& event : events) update(event);
+    }
 };
 
+template <typename Event>
 struct Subject {
-    virtual void register_observer()=0;
-    virtual void remove_observer()=0;
-    virtual void notify_observer()=0;
+    virtual ~Subject() {};
+    virtual void register_observer(Observer<Event>* observer)=0;
+    virtual void remove_observer(Observer<Event>* observer)=0;
+    virtual void notify_observer(const Event& event)=0;
 };
 
-struct ConcreteObserver {
+struct PriceEvent {
+    string symbol;
+    double price;
+};
 
+struct ConcreteObserver : public Observer<PriceEvent> {
+    string _name;
+    size_t _received = 0;
+    double _last_price = 0.0;
+    ConcreteObserver(string name="") : _name(name) {}
+    void update(const PriceEvent& event) override {
+        _received++;
+        _last_price = event.price;
+        if (!_name.empty()) cout << _name << " got " << event.symbol << " at " << event.price << endl;
+    }
+    void update_batch(const vector<PriceEvent>& events) override {
+        if (!_name.empty() || events.empty()) return Observer<PriceEvent>::update_batch(events);
+        _received += events.size();
+        _last_price = events.back().price;
+    }
 };
 
-struct ConcreteSubject {
+// Observers are kept in an immutable list that is replaced on every change
+// (read-copy-update). Notification reads the current list under a ReadGuard
+// without locking, so observers may subscribe or unsubscribe, even from
+// inside update(), while notifications run on other threads. A removed
+// observer can still get events already in flight; call synchronize() before
+// destroying it.
+template <typename Event>
+class ConcreteSubject : public Subject<Event> {
+    typedef vector<Observer<Event>*> List;
 
+    atomic<const List*> _observers;
+    mutex _writers;
+    vector<pair<const List*, uint64_t>> _retired;
+    uint64_t _last_retired = 0;
+
+    void publish(const List* next) {
+        const List* previous = _observers.exchange(next);
+        _last_retired = EpochDomain::instance().retire_epoch();
+        _retired.push_back({previous, _last_retired});
+        uint64_t oldest = EpochDomain::instance().oldest_reader();
+        auto keep = remove_if(_retired.begin(), _retired.end(), [oldest](const pair<const List*, uint64_t>& retired) {
+            if (retired.second >= oldest) return false;
+            delete retired.first;
+            return true;
+        });
+        _retired.erase(keep, _retired.end());
+    }
+
+public:
+    ConcreteSubject() : _observers(new List()) {}
+    ~ConcreteSubject() override {
+        synchronize();
+        for (auto& retired : _retired) delete retired.first;
+        delete _observers.load();
+    }
+
+    void register_observer(Observer<Event>* observer) override {
+        lock_guard<mutex> guard(_writers);
+        List* next = new List(*_observers.load());
+        next->push_back(observer);
+        publish(next);
+    }
+
+    void remove_observer(Observer<Event>* observer) override {
+        lock_guard<mutex> guard(_writers);
+        List* next = new List(*_observers.load());
+        next->erase(remove(next->begin(), next->end(), observer), next->end());
+        publish(next);
+    }
+
+    void notify_observer(const Event& event) override {
+        ReadGuard guard;
+        for (Observer<Event>* observer : *_observers.load()) observer->update(event);
+    }
+
+    // One list read for the whole burst, each observer sees all events in a row
+    void notify_observers(const vector<Event>& events) {
+        ReadGuard guard;
+        for (Observer<Event>* observer : *_observers.load()) observer->update_batch(events);
+    }
+
+    // Returns once no notification can still reach a removed observer
+    void synchronize() {
+        uint64_t epoch;
+        {
+            lock_guard<mutex> guard(_writers);
+            epoch = _last_retired;
+        }
+        EpochDomain::instance().synchronize(epoch);
+    }
+
+    size_t size() {
+        ReadGuard guard;
+        return _observers.load()->size();
+    }
 };
 
-int main() {
+// Notify cost for a growing number of observers, alone and while another
+// thread keeps subscribing and unsubscribing
+void benchmark_notify(size_t observers, bool churn) {
+    ConcreteSubject<PriceEvent> subject;
+    vector<ConcreteObserver> fixed(observers);
+    for (auto& observer : fixed) subject.register_observer(&observer);
+
+    atomic<bool> running{true};
+    size_t churned = 0;
+    thread churner;
+    ConcreteObserver extra;
+    if (churn) {
+        churner = thread([&] {
+            while (running.load(memory_order_relaxed)) {
+                subject.register_observer(&extra);
+                subject.remove_observer(&extra);
+                churned++;
+            }
+        });
+    }
+
+    size_t notifications = max<size_t>(2000000 / observers, 10);
+    PriceEvent event = {"ACME", 101.5};
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < notifications; i++) subject.notify_observer(event);
+    double single_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / notifications;
+
+    vector<PriceEvent> burst(64, event);
+    size_t bursts = max<size_t>(notifications / burst.size(), 1);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < bursts; i++) subject.notify_observers(burst);
+    double batch_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (bursts * burst.size());
+
+    running = false;
+    if (churner.joinable()) churner.join();
+    subject.synchronize();
+    cout << "  " << observers << " observers" << (churn ? " + churn" : "        ") << ": notify " << single_ns
+         << " ns, batched " << batch_ns << " ns per event";
+    if (churn) cout << ", " << churned << " subscribe/unsubscribe pairs";
+    cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+    ConcreteSubject<PriceEvent> ticker;
+    ConcreteObserver alice("Alice"), bob("Bob");
+    ticker.register_observer(&alice);
+    ticker.register_observer(&bob);
+    ticker.notify_observer({"ACME", 100.0});
+    ticker.remove_observer(&alice);
+    ticker.notify_observer({"ACME", 101.0});
+    ticker.notify_observers({{"ACME", 102.0}, {"ACME", 99.5}});
+    ticker.synchronize();
+
+    // The benchmarks take minutes in a debug build, so they only run on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmarks" << endl;
+        return 0;
+    }
 
-}
\ No newline at end of file
+    cout << "Notify cost:" << endl;
+    for (size_t observers : {1, 10, 100, 1000, 10000}) {
+        benchmark_notify(observers, false);
+        benchmark_notify(observers, true);
+    }
+}
@@ -1,78 +1,318 @@
 #include "dp_includes.h"
+#include <random>
+#include <cstdint>
+#include <stdexcept>
 
 struct TCPConnection;
 
+enum TCPStateId : uint8_t { CLOSED, LISTEN, OPEN };
+enum TCPEvent : uint8_t { EVENT_OPEN, EVENT_CLOSE, EVENT_AKNOWLEDGE };
+constexpr uint8_t TCP_EVENT_COUNT = 3;
+
 struct TCPState {
     virtual void open(TCPConnection &context)=0;
     virtual void close(TCPConnection &context)=0;
     virtual void aknowledge(TCPConnection &context)=0;
+    virtual TCPStateId id() const=0;
 };
 
+// States hold no data, so one shared instance of each (flyweight) serves
+// every connection and a transition is just a pointer assignment
 struct TCPOpen: public TCPState {
-    void open(TCPConnection &context) override {
-        cout << "TCP connection is already open." << endl;
-    };
-    void close(TCPConnection &context);
-    void aknowledge(TCPConnection &context) override {
-        cout << "Acknowledging data in TCP connection." << endl;
-    };
+    static TCPOpen &instance() { static TCPOpen state; return state; }
+    void open(TCPConnection &context) override;
+    void close(TCPConnection &context) override;
+    void aknowledge(TCPConnection &context) override;
+    TCPStateId id() const override { return OPEN; }
 };
 
-struct TCPClosed: public TCPState {   
-    void open(TCPConnection &context);
-    void close(TCPConnection &context) override {
-        cout << "TCP connection is already closed." << endl;
-    };
-    void aknowledge(TCPConnection &context) override {
-        cout << "Can't aknowledge, TCP connection is closed." << endl;
-    };
+struct TCPClosed: public TCPState {
+    static TCPClosed &instance() { static TCPClosed state; return state; }
+    void open(TCPConnection &context) override;
+    void close(TCPConnection &context) override;
+    void aknowledge(TCPConnection &context) override;
+    TCPStateId id() const override { return CLOSED; }
 };
 
 struct TCPListen: public TCPState {
-    void open(TCPConnection &context) override {
-        cout << "TCP connection is already open and listening." << endl;
-    };
-    void close(TCPConnection &context);
-    void aknowledge(TCPConnection &context);
+    static TCPListen &instance() { static TCPListen state; return state; }
+    void open(TCPConnection &context) override;
+    void close(TCPConnection &context) override;
+    void aknowledge(TCPConnection &context) override;
+    TCPStateId id() const override { return LISTEN; }
 };
 
 struct TCPConnection {
     TCPState *_state;
-    TCPConnection() : _state(new TCPClosed()) {};
+    ostream *_log = &cout;  // nullptr for silent transitions
+    TCPConnection() : _state(&TCPClosed::instance()) {};
     void set_state(TCPState &state) { _state = &state; }
+    void log(const char *message) { if (_log) *_log << message << endl; }
     void open() { _state->open(*this); }
     void close() { _state->close(*this); }
     void aknowledge() { _state->aknowledge(*this); }
 };
 
+void TCPOpen::open(TCPConnection &context) {
+        context.log("TCP connection is already open.");
+};
+
 void TCPOpen::close(TCPConnection &context) {
-        cout << "Closing TCP connection." << endl;
-        TCPClosed new_state = TCPClosed();
-        context.set_state(new_state);
+        context.log("Closing TCP connection.");
+        context.set_state(TCPClosed::instance());
+};
+
+void TCPOpen::aknowledge(TCPConnection &context) {
+        context.log("Acknowledging data in TCP connection.");
 };
 
 void TCPClosed::open(TCPConnection &context) {
-        cout << "Opening TCP connection." << endl;
-        TCPListen new_state = TCPListen();
-        context.set_state(new_state);
+        context.log("Opening TCP connection.");
+        context.set_state(TCPListen::instance());
+};
+
+void TCPClosed::close(TCPConnection &context) {
+        context.log("TCP connection is already closed.");
+};
+
+void TCPClosed::aknowledge(TCPConnection &context) {
+        context.log("Can't aknowledge, TCP connection is closed.");
+};
+
+void TCPListen::open(TCPConnection &context) {
+        context.log("TCP connection is already open and listening.");
 };
 
 void TCPListen::close(TCPConnection &context) {
-        cout << "Closing TCP connection from listening state." << endl;
-        TCPClosed new_state = TCPClosed();
-        context.set_state(new_state);
+        context.log("Closing TCP connection from listening state.");
+        context.set_state(TCPClosed::instance());
 };
 
 void TCPListen::aknowledge(TCPConnection &context) {
-        cout << "Acknowledging data in TCP connection from listening state." << endl;
-        TCPOpen new_state = TCPOpen();
-        context.set_state(new_state);
+        context.log("Acknowledging data in TCP connection from listening state.");
+        context.set_state(TCPOpen::instance());
+};
+
+// The same machine as a compile-time table indexed by [state][event]
+struct TCPTransition {
+    TCPStateId next;
+    const char *message;
+};
+
+constexpr TCPTransition TCP_TRANSITIONS[3][3] = {
+    // CLOSED
+    {{LISTEN, "Opening TCP connection."},
+     {CLOSED, "TCP connection is already closed."},
+     {CLOSED, "Can't aknowledge, TCP connection is closed."}},
+    // LISTEN
+    {{LISTEN, "TCP connection is already open and listening."},
+     {CLOSED, "Closing TCP connection from listening state."},
+     {OPEN, "Acknowledging data in TCP connection from listening state."}},
+    // OPEN
+    {{OPEN, "TCP connection is already open."},
+     {CLOSED, "Closing TCP connection."},
+     {OPEN, "Acknowledging data in TCP connection."}},
+};
+
+// Table-driven connection: one byte of state, no virtual call
+struct TCPTableConnection {
+    TCPStateId _state = CLOSED;
+    ostream *_log = &cout;
+    void handle(TCPEvent event) {
+        const TCPTransition &transition = TCP_TRANSITIONS[_state][event];
+        if (_log) *_log << transition.message << endl;
+        _state = transition.next;
+    }
+    void open() { handle(EVENT_OPEN); }
+    void close() { handle(EVENT_CLOSE); }
+    void aknowledge() { handle(EVENT_AKNOWLEDGE); }
+};
+
+// Feeds the same random events to both engines, silently, and checks they
+// agree after every step
+void benchmark_transitions(size_t count) {
+    mt19937 rng(17);
+    vector<TCPEvent> events(count);
+    for (auto &event : events) event = TCPEvent(rng() % 3);
+
+    TCPConnection connection;
+    connection._log = nullptr;
+    TCPTableConnection table;
+    table._log = nullptr;
+
+    bool match = true;
+    for (size_t i = 0; i < 100000 && i < count; i++) {
+        if (events[i] == EVENT_OPEN) connection.open();
+        else if (events[i] == EVENT_CLOSE) connection.close();
+        else connection.aknowledge();
+        table.handle(events[i]);
+        match = match && connection._state->id() == table._state;
+    }
+
+    auto start = chrono::steady_clock::now();
+    for (TCPEvent event : events) {
+        if (event == EVENT_OPEN) connection.open();
+        else if (event == EVENT_CLOSE) connection.close();
+        else connection.aknowledge();
+    }
+    double virtual_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (TCPEvent event : events) table.handle(event);
+    double table_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    match = match && connection._state->id() == table._state;
+
+    cout << count << " events: flyweight states " << count / virtual_s / 1e6 << " M/s, table "
+         << count / table_s / 1e6 << " M/s" << (match ? "" : " MISMATCH") << endl;
+}
+
+// Next state for every (state, event) packed as 2-bit fields at
+// (state * 4 + event) * 2, so a transition is a shift and a mask that
+// compilers can vectorize, instead of a memory lookup
+constexpr uint32_t pack_transitions() {
+    uint32_t packed = 0;
+    for (int state = 0; state < 3; state++) {
+        for (int event = 0; event < 3; event++) {
+            packed |= uint32_t(TCP_TRANSITIONS[state][event].next) << ((state * 4 + event) * 2);
+        }
+    }
+    return packed;
+}
+constexpr uint32_t TCP_NEXT_PACKED = pack_transitions();
+
+// Bulk mode: the states of many connections as one byte each, with running
+// per-state counts. Silent, like TCPConnection with _log set to nullptr.
+class TCPConnectionPool {
+    vector<uint8_t> _states;
+    size_t _counts[3];
+
+public:
+    explicit TCPConnectionPool(size_t connections) : _states(connections, CLOSED), _counts{connections, 0, 0} {}
+
+    static uint8_t next(uint8_t state, uint8_t event) {
+        return (TCP_NEXT_PACKED >> ((state * 4 + event) * 2)) & 3;
+    }
+
+    size_t size() const { return _states.size(); }
+    TCPStateId state(size_t id) const { return TCPStateId(_states[id]); }
+    size_t count(TCPStateId state) const { return _counts[state]; }
+
+    // events[i] goes to connection ids[i], in order, so one connection may
+    // appear several times in a batch. An unknown id throws out_of_range and
+    // an event outside TCPEvent invalid_argument, with the events before it
+    // already applied.
+    void apply(const vector<uint32_t> &ids, const vector<TCPEvent> &events) {
+        if (ids.size() != events.size()) throw invalid_argument("ids and events differ in size");
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (ids[i] >= _states.size()) throw out_of_range("no connection " + to_string(ids[i]));
+            if (events[i] >= TCP_EVENT_COUNT) throw invalid_argument("no event " + to_string(events[i]));
+            uint8_t &state = _states[ids[i]];
+            uint8_t after = next(state, events[i]);
+            _counts[state]--;
+            _counts[after]++;
+            state = after;
+        }
+    }
+
+    // One event for every connection, events[i] to connection i. No
+    // dependency between iterations, so this loop vectorizes. Events are not
+    // checked here: every one must be a TCPEvent value (below
+    // TCP_EVENT_COUNT), otherwise the shift in next() reads unused bits or
+    // goes past 32 bits, which is undefined. Use apply() for untrusted input.
+    void apply_all(const vector<TCPEvent> &events) {
+        if (events.size() != _states.size()) throw invalid_argument("need one event per connection");
+        size_t listen = 0, open = 0;
+        uint8_t *states = _states.data();
+        const TCPEvent *input = events.data();
+        for (size_t i = 0; i < _states.size(); i++) {
+            uint8_t after = next(states[i], input[i]);
+            states[i] = after;
+            listen += after == LISTEN;
+            open += after == OPEN;
+        }
+        _counts[LISTEN] = listen;
+        _counts[OPEN] = open;
+        _counts[CLOSED] = _states.size() - listen - open;
+    }
 };
 
+// Random batches through the pool and through one TCPConnection object per
+// connection must leave every connection in the same state
+bool check_pool(size_t connections, int batches) {
+    mt19937 rng(23);
+    TCPConnectionPool pool(connections);
+    vector<TCPConnection> objects(connections);
+    for (auto &connection : objects) connection._log = nullptr;
+    for (int b = 0; b < batches; b++) {
+        vector<uint32_t> ids(connections);
+        vector<TCPEvent> events(connections);
+        for (size_t i = 0; i < connections; i++) {
+            ids[i] = rng() % connections;
+            events[i] = TCPEvent(rng() % 3);
+        }
+        bool dense = b % 2;
+        if (dense) pool.apply_all(events);
+        else pool.apply(ids, events);
+        for (size_t i = 0; i < connections; i++) {
+            TCPConnection &connection = objects[dense ? i : ids[i]];
+            if (events[i] == EVENT_OPEN) connection.open();
+            else if (events[i] == EVENT_CLOSE) connection.close();
+            else connection.aknowledge();
+        }
+    }
+    size_t counts[3] = {0, 0, 0};
+    for (size_t i = 0; i < connections; i++) {
+        if (objects[i]._state->id() != pool.state(i)) return false;
+        counts[pool.state(i)]++;
+    }
+    return counts[CLOSED] == pool.count(CLOSED) && counts[LISTEN] == pool.count(LISTEN) && counts[OPEN] == pool.count(OPEN);
+}
+
+void benchmark_pool(size_t connections, size_t batch_size, int rounds) {
+    mt19937 rng(29);
+    TCPConnectionPool pool(connections);
+    vector<uint32_t> ids(batch_size);
+    vector<TCPEvent> events(batch_size);
+    for (size_t i = 0; i < batch_size; i++) {
+        ids[i] = rng() % connections;
+        events[i] = TCPEvent(rng() % 3);
+    }
+    vector<TCPEvent> all_events(connections);
+    for (auto &event : all_events) event = TCPEvent(rng() % 3);
+
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) pool.apply(ids, events);
+    double sparse_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) pool.apply_all(all_events);
+    double dense_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-int main() {
+    cout << connections << " pooled connections: batches " << batch_size * rounds / sparse_s / 1e6
+         << " M events/s, apply_all " << connections * rounds / dense_s / 1e6 << " M events/s" << endl;
+    cout << "  closed " << pool.count(CLOSED) << ", listen " << pool.count(LISTEN) << ", open "
+         << pool.count(OPEN) << endl;
+}
+
+int main(int argc, char *argv[]) {
     TCPConnection connection = TCPConnection();
     connection.open();
     connection.aknowledge();
+    connection.close();
+
+    TCPTableConnection table;
+    table.open();
+    table.aknowledge();
+    table.close();
+
+    cout << "Pool matches TCPConnection objects: " << (check_pool(10000, 20) ? "yes" : "NO") << endl;
+
+    // The benchmarks take minutes in a debug build, so they only run on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmarks" << endl;
+        return 0;
+    }
 
-}
\ No newline at end of file
+    benchmark_transitions(50000000);
+    benchmark_pool(10000000, 1000000, 10);
+}
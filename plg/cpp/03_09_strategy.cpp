@@ -1,43 +1,289 @@
 #include <iostream>
 #include <string>
 #include <algorithm> 
+#include <cctype>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <variant>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <filesystem>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The SIMD case kernels are built with GCC/Clang on x86-64, where SSE2 is
+// always there and AVX2 can be enabled per function
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS 1
+#endif
 
 using namespace std;
 
+// ASCII case kernels working in place. Bytes outside A-Z/a-z are left alone.
+// title() upper-cases the first character of every word and lower-cases the
+// rest; new_word says whether the byte before data ended a word, and the
+// return value is the same flag for the byte after, so a text can be
+// processed in pieces.
+typedef void (*CaseKernel)(char* data, size_t n);
+typedef bool (*TitleKernel)(char* data, size_t n, bool new_word);
+
+static inline bool is_space_ascii(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+static void upper_scalar(char* data, size_t n) {
+    for (size_t i = 0; i < n; i++) if (data[i] >= 'a' && data[i] <= 'z') data[i] ^= 0x20;
+}
+
+static void lower_scalar(char* data, size_t n) {
+    for (size_t i = 0; i < n; i++) if (data[i] >= 'A' && data[i] <= 'Z') data[i] ^= 0x20;
+}
+
+static bool title_scalar(char* data, size_t n, bool new_word) {
+    for (size_t i = 0; i < n; i++) {
+        char c = data[i];
+        if (is_space_ascii(c)) {
+            new_word = true;
+            continue;
+        }
+        if (new_word ? (c >= 'a' && c <= 'z') : (c >= 'A' && c <= 'Z')) data[i] ^= 0x20;
+        new_word = false;
+    }
+    return new_word;
+}
+
+#if HAS_X86_KERNELS
+// Lanes of c inside [lo, hi]; bytes >= 0x80 are negative and never match
+#define SSE2_IN_RANGE(c, lo, hi) \
+    _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)))
+#define AVX2_IN_RANGE(c, lo, hi) \
+    _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c))
+
+#define DEFINE_CASE_KERNELS(NAME, LO, HI) \
+    static void NAME##_sse2(char* data, size_t n) { \
+        size_t i = 0; \
+        for (; i + 16 <= n; i += 16) { \
+            __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i*>(data + i)); \
+            __m128i flip = _mm_and_si128(SSE2_IN_RANGE(c, LO, HI), _mm_set1_epi8(0x20)); \
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(c, flip)); \
+        } \
+        NAME##_scalar(data + i, n - i); \
+    } \
+    __attribute__((target("avx2"))) static void NAME##_avx2(char* data, size_t n) { \
+        size_t i = 0; \
+        for (; i + 32 <= n; i += 32) { \
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i*>(data + i)); \
+            __m256i flip = _mm256_and_si256(AVX2_IN_RANGE(c, LO, HI), _mm256_set1_epi8(0x20)); \
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(c, flip)); \
+        } \
+        NAME##_scalar(data + i, n - i); \
+    }
+
+DEFINE_CASE_KERNELS(upper, 'a', 'z')
+DEFINE_CASE_KERNELS(lower, 'A', 'Z')
+
+// Word starts are non-space bytes whose previous byte is a space: the space
+// mask shifted by one byte, with the last lane of the previous block carried in
+static inline __m128i space_mask_sse2(__m128i c) {
+    return _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), SSE2_IN_RANGE(c, '\t', '\r'));
+}
+
+static bool title_sse2(char* data, size_t n, bool new_word) {
+    __m128i previous = _mm_set1_epi8(new_word ? -1 : 0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i*>(data + i));
+        __m128i space = space_mask_sse2(c);
+        __m128i starts = _mm_or_si128(_mm_slli_si128(space, 1), _mm_srli_si128(previous, 15));
+        __m128i to_upper = _mm_and_si128(starts, SSE2_IN_RANGE(c, 'a', 'z'));
+        __m128i to_lower = _mm_andnot_si128(starts, SSE2_IN_RANGE(c, 'A', 'Z'));
+        __m128i flip = _mm_and_si128(_mm_or_si128(to_upper, to_lower), _mm_set1_epi8(0x20));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(c, flip));
+        previous = space;
+    }
+    if (i > 0) new_word = is_space_ascii(data[i - 1]);
+    return title_scalar(data + i, n - i, new_word);
+}
+
+__attribute__((target("avx2"))) static bool title_avx2(char* data, size_t n, bool new_word) {
+    __m256i previous = _mm256_set1_epi8(new_word ? -1 : 0);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i*>(data + i));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), AVX2_IN_RANGE(c, '\t', '\r'));
+        // [previous[31], space[0..30]], across the two 128-bit halves
+        __m256i starts = _mm256_alignr_epi8(space, _mm256_permute2x128_si256(previous, space, 0x21), 15);
+        __m256i to_upper = _mm256_and_si256(starts, AVX2_IN_RANGE(c, 'a', 'z'));
+        __m256i to_lower = _mm256_andnot_si256(starts, AVX2_IN_RANGE(c, 'A', 'Z'));
+        __m256i flip = _mm256_and_si256(_mm256_or_si256(to_upper, to_lower), _mm256_set1_epi8(0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(c, flip));
+        previous = space;
+    }
+    if (i > 0) new_word = is_space_ascii(data[i - 1]);
+    return title_scalar(data + i, n - i, new_word);
+}
+#endif
+
+struct CaseKernels {
+    const char* name;
+    CaseKernel upper, lower;
+    TitleKernel title;
+};
+
+// Kernels behind every formatter. Whether the CPU has AVX2 is only checked
+// on the first call.
+const CaseKernels& case_kernels() {
+    static const CaseKernels selected = [] {
+#if HAS_X86_KERNELS
+        if (__builtin_cpu_supports("avx2"))
+            return CaseKernels{"avx2", upper_avx2, lower_avx2, title_avx2};
+        return CaseKernels{"sse2", upper_sse2, lower_sse2, title_sse2};
+#else
+        return CaseKernels{"scalar", upper_scalar, lower_scalar, title_scalar};
+#endif
+    }();
+    return selected;
+}
+
 struct TextFormatter {
     virtual string format(string& text)=0;
+    // Formats a piece of a larger text in place; new_word tells whether the
+    // byte before data was whitespace (true at the start of the text)
+    virtual void format_chunk(char* data, size_t n, bool new_word)=0;
 };
 
-struct UpperCaseFormat : public TextFormatter {
+struct UpperCaseFormat final : public TextFormatter {
     string format(string& text) override {
-        for (auto & c: text) c = toupper(c);
+        format_chunk(&text[0], text.size(), true);
         return text;
     }
+    void format_chunk(char* data, size_t n, bool new_word) override {
+        format_chunk(case_kernels(), data, n, new_word);
+    }
+    // For callers that looked the kernels up already
+    void format_chunk(const CaseKernels& kernels, char* data, size_t n, bool) {
+        if (n < 16) upper_scalar(data, n);  // short fields: no indirect call
+        else kernels.upper(data, n);
+    }
 };
 
-struct LowerCaseFormat : public TextFormatter {
+struct LowerCaseFormat final : public TextFormatter {
     string format(string& text) override {
-        for (auto & c: text) c = tolower(c);
+        format_chunk(&text[0], text.size(), true);
         return text;
     }
+    void format_chunk(char* data, size_t n, bool new_word) override {
+        format_chunk(case_kernels(), data, n, new_word);
+    }
+    void format_chunk(const CaseKernels& kernels, char* data, size_t n, bool) {
+        if (n < 16) lower_scalar(data, n);
+        else kernels.lower(data, n);
+    }
 };
 
-struct TitleCaseFormat : public TextFormatter {
+struct TitleCaseFormat final : public TextFormatter {
     string format(string& text) override {
-        bool newWord = true;
-
-        for (size_t i = 0; text[i] != '\0'; ++i) {
-            if (std::isspace(text[i])) {
-                newWord = true;
-            } else if (newWord) {
-                text[i] = std::toupper(text[i]);
-                newWord = false;
-            } else {
-                text[i] = std::tolower(text[i]);
-            }
-        }
+        format_chunk(&text[0], text.size(), true);
+        return text;
+    }
+    void format_chunk(char* data, size_t n, bool new_word) override {
+        format_chunk(case_kernels(), data, n, new_word);
+    }
+    void format_chunk(const CaseKernels& kernels, char* data, size_t n, bool new_word) {
+        if (n < 16) title_scalar(data, n, new_word);
+        else kernels.title(data, n, new_word);
+    }
+};
+
+// Strategy chosen from a closed set at compile time. The variant still
+// allows switching at runtime, but each call resolves to the concrete
+// formatter, whose (final) methods the compiler can inline. Texts are
+// formatted in place and never copied. publish_all() dispatches once, looks
+// the kernels up once, and then runs a loop specialised for that formatter.
+template <typename... Formatters>
+class StaticTextEditor {
+    variant<Formatters...> _formatter;
+public:
+    template <typename Formatter>
+    StaticTextEditor(Formatter formatter) : _formatter(formatter) {}
+    template <typename Formatter>
+    void set_formatter(Formatter formatter) {_formatter = formatter;}
+    string& publish_text(string& text) {
+        visit([&](auto& formatter) { formatter.format_chunk(&text[0], text.size(), true); }, _formatter);
         return text;
     }
+    void publish_all(vector<string>& texts) {
+        // A local copy: stores through the texts' char pointers could alias a
+        // reference, which would make the compiler reload the kernel per text
+        const CaseKernels kernels = case_kernels();
+        visit([&](auto& formatter) {
+            for (auto& text : texts) formatter.format_chunk(kernels, &text[0], text.size(), true);
+        }, _formatter);
+    }
+};
+
+// Whole file mapped into memory. READ maps an existing file read-only;
+// CREATE creates or truncates the file to create_size bytes and maps it for
+// writing. On Windows, data points into a plain buffer instead: READ fills it
+// from the file, and a CREATE file gets it on destruction, so files larger
+// than memory only stream on POSIX.
+struct MappedFile {
+    enum Mode { READ, CREATE };
+    char* data = nullptr;
+    size_t size = 0;
+#ifndef _WIN32
+    int fd = -1;
+
+    MappedFile(const string& path, Mode mode, size_t create_size=0) {
+        bool writable = mode == CREATE;
+        fd = writable ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("cannot open " + path);
+        if (writable && ftruncate(fd, create_size) != 0) throw runtime_error("cannot resize " + path);
+        struct stat info;
+        fstat(fd, &info);
+        size = info.st_size;
+        if (size == 0) return;
+        void* map = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) throw runtime_error("cannot map " + path);
+        data = static_cast<char*>(map);
+        if (!writable) madvise(map, size, MADV_SEQUENTIAL);
+    }
+    ~MappedFile() {
+        if (data) munmap(data, size);
+        if (fd >= 0) close(fd);
+    }
+#else
+    string path;
+    Mode mode;
+    vector<char> buffer;
+
+    MappedFile(const string& path, Mode mode, size_t create_size=0) : path(path), mode(mode) {
+        if (mode == CREATE) {
+            if (!ofstream(path, ios::binary | ios::trunc)) throw runtime_error("cannot open " + path);
+            buffer.resize(create_size);
+        } else {
+            ifstream in(path, ios::binary);
+            if (!in) throw runtime_error("cannot open " + path);
+            buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        }
+        size = buffer.size();
+        data = size ? buffer.data() : nullptr;
+    }
+    ~MappedFile() {
+        if (mode == CREATE) ofstream(path, ios::binary | ios::trunc).write(buffer.data(), buffer.size());
+    }
+#endif
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
 };
 
 struct TextEditor {
@@ -47,9 +293,178 @@ struct TextEditor {
         TextEditor(TextFormatter* formatter) : _formatter(formatter) {}
         void set_formatter(TextFormatter* formatter) {_formatter = formatter;}
         string publish_text(string& text) {return _formatter->format(text);}    
+        // Streaming mode for files larger than memory: both files are mapped,
+        // the input is cut into chunks ending after whitespace where possible,
+        // and worker threads copy and format one cache-sized block at a time
+        // straight into the output mapping. Whether a block starts a word only
+        // depends on the byte before it, so no state passes between chunks.
+        void publish_file(const string& input_path, const string& output_path,
+                          unsigned threads=thread::hardware_concurrency(), size_t chunk_size=8 << 20) {
+            MappedFile input(input_path, MappedFile::READ);
+            MappedFile output(output_path, MappedFile::CREATE, input.size);
+            if (input.size == 0) return;
+            const char* in = input.data;
+            char* out = output.data;
+
+            vector<size_t> bounds = {0};
+            chunk_size = max<size_t>(chunk_size, 1);
+            while (bounds.back() < input.size) {
+                size_t end = min(bounds.back() + chunk_size, input.size);
+                size_t limit = min(end + 4096, input.size);
+                size_t cut = end;
+                while (cut < limit && !is_space_ascii(in[cut - 1])) cut++;
+                bounds.push_back(cut < limit ? cut : end);
+            }
+
+            atomic<size_t> next_chunk{0};
+            auto worker = [&] {
+                const size_t BLOCK = 64 << 10;
+                for (size_t c = next_chunk++; c + 1 < bounds.size(); c = next_chunk++) {
+                    for (size_t begin = bounds[c]; begin < bounds[c + 1]; begin += BLOCK) {
+                        size_t n = min(BLOCK, bounds[c + 1] - begin);
+                        memcpy(out + begin, in + begin, n);
+                        _formatter->format_chunk(out + begin, n, begin == 0 || is_space_ascii(in[begin - 1]));
+                    }
+                }
+            };
+            vector<thread> workers;
+            for (unsigned t = 1; t < max(threads, 1u); t++) workers.emplace_back(worker);
+            worker();
+            for (auto& w : workers) w.join();
+        }
 };
 
-int main() {
+// The per-character loops the strategies used before the kernels
+void upper_per_char(string& text) { for (auto & c: text) c = toupper(c); }
+void lower_per_char(string& text) { for (auto & c: text) c = tolower(c); }
+void title_per_char(string& text) {
+    bool newWord = true;
+    for (size_t i = 0; text[i] != '\0'; ++i) {
+        if (std::isspace(text[i])) {
+            newWord = true;
+        } else if (newWord) {
+            text[i] = std::toupper(text[i]);
+            newWord = false;
+        } else {
+            text[i] = std::tolower(text[i]);
+        }
+    }
+}
+
+template <typename Format>
+double gigabytes_per_second(string& text, int rounds, Format format) {
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) format(text);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return double(text.size()) * rounds / seconds / 1e9;
+}
+
+void benchmark_case_kernels(size_t size, int rounds) {
+    string sample;
+    const char* words[] = {"GET", "/index.html", "took", "12ms", "Status:", "OK", "user-Agent", "\tretry\n"};
+    for (size_t i = 0; sample.size() < size; i++) sample += string(words[i * 7 % 8]) + " ";
+    sample.resize(size);
+
+    // Every kernel must agree with the old loops before timing them
+    bool match = true;
+    vector<CaseKernels> candidates = {{"scalar", upper_scalar, lower_scalar, title_scalar}, case_kernels()};
+#if HAS_X86_KERNELS
+    candidates.push_back({"sse2", upper_sse2, lower_sse2, title_sse2});
+#endif
+    for (const CaseKernels& kernels : candidates) {
+        string expected = sample, actual = sample;
+        upper_per_char(expected); kernels.upper(&actual[0], actual.size()); match = match && expected == actual;
+        expected = sample; actual = sample;
+        lower_per_char(expected); kernels.lower(&actual[0], actual.size()); match = match && expected == actual;
+        expected = sample; actual = sample;
+        title_per_char(expected); kernels.title(&actual[0], actual.size(), true); match = match && expected == actual;
+    }
+
+    const CaseKernels& kernels = case_kernels();
+    string text = sample;
+    cout << "Case kernels (" << kernels.name << ") on " << size / 1024 << " KiB, GB/s"
+         << (match ? "" : " MISMATCH") << ":" << endl;
+    cout << "  upper: per char " << gigabytes_per_second(text, rounds, upper_per_char)
+         << ", kernel " << gigabytes_per_second(text, rounds, [&](string& t) { kernels.upper(&t[0], t.size()); }) << endl;
+    cout << "  lower: per char " << gigabytes_per_second(text, rounds, lower_per_char)
+         << ", kernel " << gigabytes_per_second(text, rounds, [&](string& t) { kernels.lower(&t[0], t.size()); }) << endl;
+    cout << "  title: per char " << gigabytes_per_second(text, rounds, title_per_char)
+         << ", kernel " << gigabytes_per_second(text, rounds, [&](string& t) { kernels.title(&t[0], t.size(), true); }) << endl;
+}
+
+// Formats a generated file with every strategy and compares with publish_text.
+// A tiny chunk size in the last run forces cuts inside words.
+void benchmark_publish_file(size_t size) {
+    string input_path = (filesystem::temp_directory_path() / "strategy_input.txt").string();
+    string output_path = (filesystem::temp_directory_path() / "strategy_output.txt").string();
+    string sample;
+    const char* words[] = {"GET", "/index.html", "took", "12ms", "Status:", "OK", "user-Agent", "\tretry\n"};
+    for (size_t i = 0; sample.size() < size; i++) sample += string(words[i * 7 % 8]) + " ";
+    sample += string(20000, 'x');
+    {
+        ofstream file(input_path, ios::binary);
+        file.write(sample.data(), sample.size());
+    }
+
+    UpperCaseFormat upper;
+    LowerCaseFormat lower;
+    TitleCaseFormat title;
+    struct Run { const char* name; TextFormatter* formatter; size_t chunk_size; };
+    cout << "Formatting a " << sample.size() / (1 << 20) << " MiB file:" << endl;
+    for (Run run : {Run{"upper", &upper, 8 << 20}, Run{"lower", &lower, 8 << 20},
+                    Run{"title", &title, 8 << 20}, Run{"title, 1 KiB chunks", &title, 1024}}) {
+        TextEditor editor(run.formatter);
+        auto start = chrono::steady_clock::now();
+        editor.publish_file(input_path, output_path, thread::hardware_concurrency(), run.chunk_size);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        string expected = sample;
+        editor.publish_text(expected);
+        ifstream file(output_path, ios::binary);
+        string actual((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        cout << "  " << run.name << ": " << sample.size() / seconds / 1e9 << " GB/s"
+             << (actual == expected ? "" : " MISMATCH") << endl;
+    }
+    remove(input_path.c_str());
+    remove(output_path.c_str());
+}
+
+// Many short log fields through the virtual editor and the static one
+void benchmark_static_editor(size_t fields_count, int rounds) {
+    const char* samples[] = {"GET", "/api/v1/users", "200", "chrome", "eu-west-1", "timeout", "ok", "retry"};
+    vector<string> fields(fields_count);
+    for (size_t i = 0; i < fields_count; i++) fields[i] = samples[i % 8];
+
+    // Every path formats in place, so only the dispatch differs
+    TitleCaseFormat title;
+    TextFormatter* virtual_formatter = &title;
+    StaticTextEditor<UpperCaseFormat, LowerCaseFormat, TitleCaseFormat> static_editor{TitleCaseFormat()};
+
+    volatile size_t checksum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+        for (auto& field : fields) virtual_formatter->format_chunk(&field[0], field.size(), true);
+    double virtual_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (fields_count * rounds);
+
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+        for (auto& field : fields) checksum += static_editor.publish_text(field).size();
+    double static_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (fields_count * rounds);
+
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) static_editor.publish_all(fields);
+    double batch_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (fields_count * rounds);
+
+    vector<string> expected(fields_count);
+    for (size_t i = 0; i < fields_count; i++) {
+        expected[i] = samples[i % 8];
+        title_per_char(expected[i]);
+    }
+    cout << fields_count << " log fields: virtual " << virtual_ns << " ns, static " << static_ns
+         << " ns, static batch " << batch_ns << " ns per field" << (fields == expected ? "" : " MISMATCH") << endl;
+}
+
+int main(int argc, char* argv[]) {
     TextFormatter* upper_formatter = new UpperCaseFormat();
     TextFormatter* lower_formatter = new LowerCaseFormat();
     TextFormatter* title_formatter = new TitleCaseFormat();
@@ -63,6 +478,22 @@ int main() {
     editor.set_formatter(title_formatter);
     cout << editor.publish_text(text) << endl;
 
+    StaticTextEditor<UpperCaseFormat, LowerCaseFormat, TitleCaseFormat> static_editor{UpperCaseFormat()};
+    string static_text = "this is the text to be formatted";
+    cout << static_editor.publish_text(static_text) << endl;
+    static_editor.set_formatter(TitleCaseFormat());
+    cout << static_editor.publish_text(static_text) << endl;
+
+    // The benchmarks take minutes in a debug build and write a 64 MiB file,
+    // so they only run on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmarks" << endl;
+        return 0;
+    }
+
+    benchmark_case_kernels(1 << 20, 200);
+    benchmark_publish_file(64 << 20);
+    benchmark_static_editor(1000000, 10);
 
     return 0;
 }
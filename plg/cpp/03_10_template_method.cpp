@@ -1,7 +1,44 @@
 #include "dp_includes.h"
 
+// One drink being prepared, for the data-driven versions of the recipe
+struct Cup {
+    double water_ml = 0.0;
+    double temperature = 20.0;
+    double strength = 0.0;
+    double sugar_g = 0.0;
+    double milk_ml = 0.0;
+    double lemon = 0.0;
+};
+
+// Many cups stored field by field: each recipe step reads and writes a few
+// of these arrays and nothing else, so a step over a range of cups is a
+// plain loop over doubles
+struct CupBatch {
+    vector<double> water_ml, temperature, strength, sugar_g, milk_ml, lemon;
+
+    explicit CupBatch(size_t n) :
+        water_ml(n, 0.0), temperature(n, 20.0), strength(n, 0.0), sugar_g(n, 0.0), milk_ml(n, 0.0), lemon(n, 0.0) {}
+
+    size_t size() const { return water_ml.size(); }
+    Cup cup(size_t i) const { return {water_ml[i], temperature[i], strength[i], sugar_g[i], milk_ml[i], lemon[i]}; }
+};
+
+// One cup of a CupBatch, with the same field names as Cup
+struct CupRef {
+    double &water_ml, &temperature, &strength, &sugar_g, &milk_ml, &lemon;
+};
+
+// Recipe steps shared by the virtual and the static beverages, for a Cup or
+// a CupRef
+template <typename C> inline void boil_water_into(C &cup) { cup.water_ml = 250.0; cup.temperature = 100.0; }
+template <typename C> inline void pour_into_cup(C &cup) { cup.temperature -= 10.0; }
+template <typename C> inline void steep_tea(C &cup) { cup.strength = cup.water_ml * 0.004; cup.temperature -= 5.0; }
+template <typename C> inline void add_lemon(C &cup) { cup.lemon += 1.0; cup.temperature -= 1.0; }
+template <typename C> inline void drip_coffee(C &cup) { cup.strength = cup.water_ml * 0.01; cup.temperature -= 8.0; }
+template <typename C> inline void add_sugar_and_milk(C &cup) { cup.sugar_g += 5.0; cup.milk_ml += 30.0; cup.temperature -= 3.0; }
+
 struct Beverage {
-    
+
     void prepare_beverage() {
         boil_water();
         brew();
@@ -13,25 +50,211 @@ struct Beverage {
 
     virtual void brew()=0;
     virtual void add_condiments()=0;
+
+    // Same template method on data, without console output
+    void prepare_beverage(Cup &cup) {
+        boil_water_into(cup);
+        brew(cup);
+        pour_into_cup(cup);
+        add_condiments(cup);
+    }
+    virtual void brew(Cup &cup)=0;
+    virtual void add_condiments(Cup &cup)=0;
 };
 
 struct Tea : public Beverage {
+    using Beverage::brew;
+    using Beverage::add_condiments;
     void brew() override { cout << "Steeping the Tea" << endl; }
     void add_condiments() override { cout << "Adding Lemon" << endl; }
+    void brew(Cup &cup) override { steep_tea(cup); }
+    void add_condiments(Cup &cup) override { add_lemon(cup); }
 };
 
 struct Coffee : public Beverage {
+    using Beverage::brew;
+    using Beverage::add_condiments;
     void brew() override { cout << "Dripping Cofee Through Filter" << endl; }
     void add_condiments() override { cout << "Adding Sugar and Milk" << endl; }
+    void brew(Cup &cup) override { drip_coffee(cup); }
+    void add_condiments(Cup &cup) override { add_sugar_and_milk(cup); }
 };
 
 void prepare_beverage(Beverage *beverage) { beverage->prepare_beverage(); }
 
-int main() {
+enum Step { BOIL_WATER, BREW, POUR_IN_CUP, ADD_CONDIMENTS };
+const char *const STEP_NAMES[] = {"boil water", "brew", "pour in cup", "add condiments"};
+
+// Hooks run around every step, with the number of cups it covers: one for
+// prepare_beverage(), a whole tile for prepare_batch(). The empty ones
+// compile away.
+struct NoHooks {
+    void before_step(Step, size_t) {}
+    void after_step(Step, size_t) {}
+};
+
+struct ConsoleHooks {
+    void before_step(Step step, size_t count) { cout << "Step '" << STEP_NAMES[step] << "' for " << count << " cups" << endl; }
+    void after_step(Step, size_t) {}
+};
+
+// Time spent in each step, the kind of hook a staged pipeline keeps on
+struct StepTimer {
+    double ns[4] = {};
+    chrono::steady_clock::time_point started;
+    void before_step(Step, size_t) { started = chrono::steady_clock::now(); }
+    void after_step(Step step, size_t) { ns[step] += chrono::duration<double, nano>(chrono::steady_clock::now() - started).count(); }
+};
+
+// Template method resolved at compile time (CRTP): Derived supplies brew()
+// and add_condiments() for one cup, as templates taking a Cup or a CupRef,
+// and every call is direct, so it can be inlined.
+// prepare_batch() runs each step over a tile of a CupBatch before starting
+// the next one, so hooks run once per step and tile instead of once per cup
+// and the tile stays in cache between steps. Each step is a loop over the
+// arrays it touches; GCC vectorizes those at -O3. With steps as cheap as
+// these, one pass per cup is still faster when the hooks do nothing; the
+// batch wins once they do real work, see benchmark_beverages().
+template <typename Derived, typename Hooks=NoHooks>
+struct StaticBeverage {
+    Hooks _hooks;
+
+    void prepare_beverage(Cup &cup) {
+        Derived &self = static_cast<Derived&>(*this);
+        run_step(BOIL_WATER, cup, [](Cup &c) { boil_water_into(c); });
+        run_step(BREW, cup, [&self](Cup &c) { self.brew(c); });
+        run_step(POUR_IN_CUP, cup, [](Cup &c) { pour_into_cup(c); });
+        run_step(ADD_CONDIMENTS, cup, [&self](Cup &c) { self.add_condiments(c); });
+    }
+
+    static constexpr size_t TILE = 256;
+
+    // Prepares cups [begin, end) of batch
+    void prepare_batch(CupBatch &batch, size_t begin, size_t end) {
+        Derived &self = static_cast<Derived&>(*this);
+        for (size_t tile = begin; tile < end; tile += TILE) {
+            size_t count = min(TILE, end - tile);
+            run_step(BOIL_WATER, batch, tile, count, [](CupRef cup) { boil_water_into(cup); });
+            run_step(BREW, batch, tile, count, [&self](CupRef cup) { self.brew(cup); });
+            run_step(POUR_IN_CUP, batch, tile, count, [](CupRef cup) { pour_into_cup(cup); });
+            run_step(ADD_CONDIMENTS, batch, tile, count, [&self](CupRef cup) { self.add_condiments(cup); });
+        }
+    }
+
+private:
+    template <typename Action>
+    void run_step(Step step, Cup &cup, Action action) {
+        _hooks.before_step(step, 1);
+        action(cup);
+        _hooks.after_step(step, 1);
+    }
+
+    template <typename Action>
+    void run_step(Step step, CupBatch &batch, size_t begin, size_t count, Action action) {
+        _hooks.before_step(step, count);
+        double *__restrict water_ml = batch.water_ml.data() + begin, *__restrict temperature = batch.temperature.data() + begin;
+        double *__restrict strength = batch.strength.data() + begin, *__restrict sugar_g = batch.sugar_g.data() + begin;
+        double *__restrict milk_ml = batch.milk_ml.data() + begin, *__restrict lemon = batch.lemon.data() + begin;
+        auto step_cups = [&](size_t n) {
+            for (size_t i = 0; i < n; i++)
+                action(CupRef{water_ml[i], temperature[i], strength[i], sugar_g[i], milk_ml[i], lemon[i]});
+        };
+        // Full tiles get a constant trip count, so the vector loop needs no remainder
+        if (count == TILE) step_cups(TILE);
+        else step_cups(count);
+        _hooks.after_step(step, count);
+    }
+};
+
+template <typename Hooks=NoHooks>
+struct StaticTea : public StaticBeverage<StaticTea<Hooks>, Hooks> {
+    template <typename C> void brew(C &cup) { steep_tea(cup); }
+    template <typename C> void add_condiments(C &cup) { add_lemon(cup); }
+};
+
+template <typename Hooks=NoHooks>
+struct StaticCoffee : public StaticBeverage<StaticCoffee<Hooks>, Hooks> {
+    template <typename C> void brew(C &cup) { drip_coffee(cup); }
+    template <typename C> void add_condiments(C &cup) { add_sugar_and_milk(cup); }
+};
+
+bool same_cup(const Cup &a, const Cup &b) {
+    return a.water_ml == b.water_ml && a.temperature == b.temperature && a.strength == b.strength
+        && a.sugar_g == b.sugar_g && a.milk_ml == b.milk_ml && a.lemon == b.lemon;
+}
+
+// CRTP per cup against CRTP batch, both with the given hooks; returns ns per
+// cup for each and adds whether every cup matches expected
+template <typename Hooks>
+pair<double, double> time_static(size_t orders, int rounds, const vector<Cup> &expected, bool &match) {
+    size_t teas = orders / 2;
+    vector<Cup> cups(orders);
+    CupBatch batch(orders);
+    StaticTea<Hooks> tea;
+    StaticCoffee<Hooks> coffee;
+
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < teas; i++) tea.prepare_beverage(cups[i]);
+        for (size_t i = teas; i < orders; i++) coffee.prepare_beverage(cups[i]);
+    }
+    double per_cup_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (orders * rounds);
+
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        tea.prepare_batch(batch, 0, teas);
+        coffee.prepare_batch(batch, teas, orders);
+    }
+    double batch_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (orders * rounds);
+
+    for (size_t i = 0; i < orders; i++) match = match && same_cup(expected[i], cups[i]) && same_cup(expected[i], batch.cup(i));
+    return {per_cup_ns, batch_ns};
+}
+
+// Prepares the same tea and coffee orders with every recipe and checks that
+// all the cups match, field by field
+void benchmark_beverages(size_t orders, int rounds) {
+    vector<Cup> virtual_cups(orders);
+    size_t teas = orders / 2;
+    Tea tea;
+    Coffee coffee;
+    vector<Beverage*> recipes(orders);
+    for (size_t i = 0; i < orders; i++) recipes[i] = i < teas ? static_cast<Beverage*>(&tea) : &coffee;
+
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+        for (size_t i = 0; i < orders; i++) recipes[i]->prepare_beverage(virtual_cups[i]);
+    double virtual_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (orders * rounds);
+
+    bool match = true;
+    pair<double, double> plain = time_static<NoHooks>(orders, rounds, virtual_cups, match);
+    pair<double, double> timed = time_static<StepTimer>(orders, rounds, virtual_cups, match);
+
+    cout << orders << " orders, ns per cup" << (match ? "" : " MISMATCH") << ":" << endl;
+    cout << "  virtual " << virtual_ns << endl;
+    cout << "  CRTP " << plain.first << ", CRTP batch " << plain.second << endl;
+    cout << "  with step timers: CRTP " << timed.first << ", CRTP batch " << timed.second << endl;
+}
+
+int main(int argc, char *argv[]) {
     cout << "Preparing Tea ..." << endl;
     Tea tea = Tea();
     prepare_beverage(&tea);
     cout << "Preparing Coffee ..." << endl;
     Coffee coffee = Coffee();
     prepare_beverage(&coffee);
-}
\ No newline at end of file
+
+    cout << "Preparing 3 Coffees in a batch ..." << endl;
+    StaticCoffee<ConsoleHooks> coffees;
+    CupBatch cups(3);
+    coffees.prepare_batch(cups, 0, cups.size());
+
+    // The benchmark takes minutes in a debug build, so it only runs on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmark" << endl;
+        return 0;
+    }
+
+    // Few enough orders to stay in cache, so the recipes are timed and not memory
+    benchmark_beverages(10000, 2000);
+}
@@ -1,47 +1,246 @@
 #include "dp_includes.h"
+#include <variant>
+#include <memory>
+#include <random>
+#include <cmath>
 
 struct ShapeVisitor;
 
+// Pointer and length over a dense array of one shape type
+template <typename T>
+struct Span {
+    T* data;
+    size_t size;
+    T* begin() const { return data; }
+    T* end() const { return data + size; }
+};
+
+// Geometry of each shape as a plain struct, no vptr: the value-semantic
+// paths below store these directly, and the classic classes inherit them
+struct CircleValue {
+    double radius = 1.0;
+    double area() const { return 3.141592653589793 * radius * radius; }
+    void draw(ostream* out=&cout) const { if (out) *out << "Drawing Circle" << endl; }
+    void resize(double factor, ostream* out=&cout) {
+        radius *= factor;
+        if (out) *out << "Resizing Circle" << endl;
+    }
+};
+struct SquareValue {
+    double side = 1.0;
+    double area() const { return side * side; }
+    void draw(ostream* out=&cout) const { if (out) *out << "Drawing Square" << endl; }
+    void resize(double factor, ostream* out=&cout) {
+        side *= factor;
+        if (out) *out << "Resizing Square" << endl;
+    }
+};
+struct RectangleValue {
+    double width = 2.0;
+    double height = 1.0;
+    double area() const { return width * height; }
+    void draw(ostream* out=&cout) const { if (out) *out << "Drawing Rectangle" << endl; }
+    void resize(double factor, ostream* out=&cout) {
+        width *= factor;
+        height *= factor;
+        if (out) *out << "Resizing Rectangle" << endl;
+    }
+};
+
 struct Shape {
+    virtual ~Shape() {};
     virtual void accept(ShapeVisitor* visitor)=0;
 };
-struct Circle : public Shape {
-    void accept(ShapeVisitor* visitor);
-    void draw() { cout << "Drawing Circle" << endl; }
-    void resize() { cout << "Resizing Circle" << endl; }
+struct Circle : public Shape, public CircleValue {
+    void accept(ShapeVisitor* visitor) override;
 };
-struct Square : public Shape {
-    void accept(ShapeVisitor* visitor);
-    void draw() { cout << "Drawing Square" << endl; }
-    void resize() { cout << "Resizing Square" << endl; }
+struct Square : public Shape, public SquareValue {
+    void accept(ShapeVisitor* visitor) override;
 };
-struct Rectangle : public Shape {
-    void accept(ShapeVisitor* visitor);
-    void draw() { cout << "Drawing Square" << endl; }
-    void resize() { cout << "Resizing Square" << endl; }
+struct Rectangle : public Shape, public RectangleValue {
+    void accept(ShapeVisitor* visitor) override;
 };
 
 struct ShapeVisitor {
+    virtual ~ShapeVisitor() {};
     virtual void visit_circle(Circle* circle)=0;
     virtual void visit_square(Square* square)=0;
     virtual void visit_rectangle(Rectangle* rectangle)=0;
+    // Whole runs of one type, see ShapeBuckets
+    virtual void visit_circles(Span<CircleValue> circles)=0;
+    virtual void visit_squares(Span<SquareValue> squares)=0;
+    virtual void visit_rectangles(Span<RectangleValue> rectangles)=0;
 };
-struct DrawVisitor : public ShapeVisitor{
-    void visit_circle(Circle * circle) override { circle->draw(); }
-    void visit_square(Square * square) override { square->draw(); }
-    void visit_rectangle(Rectangle * rectangle) override { rectangle->draw(); }
+// Every visitor works on the plain values through visit_value(); the
+// hierarchy's visit_*() calls forward to it. _out set to nullptr draws
+// silently; the drawn area is summed either way.
+struct DrawVisitor final : public ShapeVisitor{
+    ostream* _out = &cout;
+    double _drawn_area = 0.0;
+    void visit_value(const CircleValue& circle) { _drawn_area += circle.area(); circle.draw(_out); }
+    void visit_value(const SquareValue& square) { _drawn_area += square.area(); square.draw(_out); }
+    void visit_value(const RectangleValue& rectangle) { _drawn_area += rectangle.area(); rectangle.draw(_out); }
+    void visit_circle(Circle * circle) override { visit_value(*circle); }
+    void visit_square(Square * square) override { visit_value(*square); }
+    void visit_rectangle(Rectangle * rectangle) override { visit_value(*rectangle); }
+    void visit_circles(Span<CircleValue> circles) override {
+        if (_out) { for (const CircleValue& c : circles) visit_value(c); return; }
+        double area = 0.0;
+        for (const CircleValue& c : circles) area += c.radius * c.radius;
+        _drawn_area += 3.141592653589793 * area;
+    }
+    void visit_squares(Span<SquareValue> squares) override {
+        if (_out) { for (const SquareValue& s : squares) visit_value(s); return; }
+        double area = 0.0;
+        for (const SquareValue& s : squares) area += s.area();
+        _drawn_area += area;
+    }
+    void visit_rectangles(Span<RectangleValue> rectangles) override {
+        if (_out) { for (const RectangleValue& r : rectangles) visit_value(r); return; }
+        double area = 0.0;
+        for (const RectangleValue& r : rectangles) area += r.area();
+        _drawn_area += area;
+    }
 };
-struct ResizeVisitor : public ShapeVisitor{
-    void visit_circle(Circle * circle) override { circle->resize(); }
-    void visit_square(Square * square) override { square->resize(); }
-    void visit_rectangle(Rectangle * rectangle) override { rectangle->resize(); }
+struct ResizeVisitor final : public ShapeVisitor{
+    ostream* _out = &cout;
+    double _factor = 1.0;
+    void visit_value(CircleValue& circle) { circle.resize(_factor, _out); }
+    void visit_value(SquareValue& square) { square.resize(_factor, _out); }
+    void visit_value(RectangleValue& rectangle) { rectangle.resize(_factor, _out); }
+    void visit_circle(Circle * circle) override { visit_value(*circle); }
+    void visit_square(Square * square) override { visit_value(*square); }
+    void visit_rectangle(Rectangle * rectangle) override { visit_value(*rectangle); }
+    void visit_circles(Span<CircleValue> circles) override {
+        if (_out) { for (CircleValue& c : circles) visit_value(c); return; }
+        for (CircleValue& c : circles) c.radius *= _factor;
+    }
+    void visit_squares(Span<SquareValue> squares) override {
+        if (_out) { for (SquareValue& s : squares) visit_value(s); return; }
+        for (SquareValue& s : squares) s.side *= _factor;
+    }
+    void visit_rectangles(Span<RectangleValue> rectangles) override {
+        if (_out) { for (RectangleValue& r : rectangles) visit_value(r); return; }
+        for (RectangleValue& r : rectangles) {
+            r.width *= _factor;
+            r.height *= _factor;
+        }
+    }
 };
 
 void Circle::accept(ShapeVisitor* visitor) { visitor -> visit_circle(this); }
 void Square::accept(ShapeVisitor* visitor) { visitor -> visit_square(this); }
 void Rectangle::accept(ShapeVisitor* visitor) { visitor -> visit_rectangle(this); }
 
-int main() {
+// Value-semantic shapes: plain structs stored inline in one contiguous array,
+// no accept() call. std::visit picks the alternative through a jump table,
+// and since the visitor's static type is known (and final) its visit_value()
+// call is direct.
+typedef variant<CircleValue, SquareValue, RectangleValue> ShapeValue;
+
+template <typename Visitor>
+struct VisitShape {
+    Visitor& visitor;
+    template <typename Value>
+    void operator()(Value& value) { visitor.visit_value(value); }
+};
+
+template <typename Visitor>
+void visit_shapes(vector<ShapeValue>& shapes, Visitor& visitor) {
+    VisitShape<Visitor> call{visitor};
+    for (ShapeValue& shape : shapes) visit(call, shape);
+}
+
+// Scene kept as one dense array of plain values per type. apply() makes one
+// virtual call per type instead of two per shape; the order between shapes
+// of different types is not kept.
+class ShapeBuckets {
+    vector<CircleValue> _circles;
+    vector<SquareValue> _squares;
+    vector<RectangleValue> _rectangles;
+
+public:
+    void add(const CircleValue& circle) { _circles.push_back(circle); }
+    void add(const SquareValue& square) { _squares.push_back(square); }
+    void add(const RectangleValue& rectangle) { _rectangles.push_back(rectangle); }
+    size_t size() const { return _circles.size() + _squares.size() + _rectangles.size(); }
+    const vector<CircleValue>& circles() const { return _circles; }
+    const vector<SquareValue>& squares() const { return _squares; }
+    const vector<RectangleValue>& rectangles() const { return _rectangles; }
+
+    void apply(ShapeVisitor& visitor) {
+        visitor.visit_circles({_circles.data(), _circles.size()});
+        visitor.visit_squares({_squares.data(), _squares.size()});
+        visitor.visit_rectangles({_rectangles.data(), _rectangles.size()});
+    }
+};
+
+// Draws and resizes the same random scene held three ways, then checks the
+// drawn areas and every resized shape
+void benchmark_dispatch(size_t count) {
+    mt19937 rng(31);
+    vector<unique_ptr<Shape>> owned;
+    vector<Shape*> pointers;
+    vector<ShapeValue> values;
+    ShapeBuckets buckets;
+    owned.reserve(count);
+    pointers.reserve(count);
+    values.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        switch (rng() % 3) {
+            case 0: owned.emplace_back(new Circle()); values.emplace_back(CircleValue()); buckets.add(CircleValue()); break;
+            case 1: owned.emplace_back(new Square()); values.emplace_back(SquareValue()); buckets.add(SquareValue()); break;
+            default: owned.emplace_back(new Rectangle()); values.emplace_back(RectangleValue()); buckets.add(RectangleValue()); break;
+        }
+        pointers.push_back(owned.back().get());
+    }
+
+    DrawVisitor draw, value_draw, bucket_draw;
+    draw._out = value_draw._out = bucket_draw._out = nullptr;
+    ResizeVisitor resize, value_resize, bucket_resize;
+    resize._out = value_resize._out = bucket_resize._out = nullptr;
+    resize._factor = value_resize._factor = bucket_resize._factor = 1.5;
+
+    auto start = chrono::steady_clock::now();
+    for (Shape* shape : pointers) shape->accept(&draw);
+    for (Shape* shape : pointers) shape->accept(&resize);
+    double double_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    visit_shapes(values, value_draw);
+    visit_shapes(values, value_resize);
+    double variant_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    buckets.apply(bucket_draw);
+    buckets.apply(bucket_resize);
+    double bucket_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    // Buckets sum the areas in another order, so allow for rounding
+    bool match = draw._drawn_area == value_draw._drawn_area
+                 && abs(bucket_draw._drawn_area - draw._drawn_area) <= 1e-9 * draw._drawn_area;
+    // Buckets keep the order of the shapes within each type
+    size_t circle = 0, square = 0, rectangle = 0;
+    for (size_t i = 0; i < count && match; i++) {
+        if (Circle* c = dynamic_cast<Circle*>(pointers[i])) {
+            match = c->radius == get<CircleValue>(values[i]).radius
+                    && c->radius == buckets.circles()[circle++].radius;
+        } else if (Square* s = dynamic_cast<Square*>(pointers[i])) {
+            match = s->side == get<SquareValue>(values[i]).side
+                    && s->side == buckets.squares()[square++].side;
+        } else {
+            Rectangle* r = static_cast<Rectangle*>(pointers[i]);
+            const RectangleValue& value = get<RectangleValue>(values[i]);
+            const RectangleValue& bucket = buckets.rectangles()[rectangle++];
+            match = r->width == value.width && r->height == value.height
+                    && r->width == bucket.width && r->height == bucket.height;
+        }
+    }
+    cout << count << " shapes, draw + resize: double dispatch " << double_ms << " ms, variant "
+         << variant_ms << " ms, buckets " << bucket_ms << " ms" << (match ? "" : " MISMATCH") << endl;
+}
+
+int main(int argc, char* argv[]) {
     vector<Shape*> shapes = {new Circle(), new Square(), new Rectangle()};
     ShapeVisitor* draw_visitor = new DrawVisitor();
     ShapeVisitor* resize_visitor = new ResizeVisitor();
@@ -49,4 +248,21 @@ int main() {
         shape->accept(draw_visitor);
         shape->accept(resize_visitor);
     }
-}
\ No newline at end of file
+
+    vector<ShapeValue> values = {CircleValue(), SquareValue(), RectangleValue()};
+    DrawVisitor value_draw;
+    visit_shapes(values, value_draw);
+
+    ShapeBuckets buckets;
+    buckets.add(RectangleValue());
+    buckets.add(CircleValue());
+    buckets.apply(value_draw);
+
+    // The benchmark takes minutes in a debug build, so it only runs on request
+    if (argc < 2 || string(argv[1]) != "--bench") {
+        cout << "Run with --bench for the benchmark" << endl;
+        return 0;
+    }
+
+    benchmark_dispatch(10000000);
+}